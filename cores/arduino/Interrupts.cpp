@@ -18,6 +18,20 @@
 
 #include "Arduino.h"
 #include "pinDefinitions.h"
+#include "Pool.h"
+
+// InterruptIn objects for the first pins used come from a static pool,
+// further ones from the heap
+#ifndef IRQ_POOL_SIZE
+#define IRQ_POOL_SIZE 8
+#endif
+
+static arduino::Pool<mbed::InterruptIn, IRQ_POOL_SIZE> irq_pool;
+
+static mbed::InterruptIn* new_irq(PinName pin) {
+  mbed::InterruptIn* irq = irq_pool.create(pin);
+  return irq != NULL ? irq : new mbed::InterruptIn(pin);
+}
 
 void detachInterrupt(PinName interruptNum) {
   pin_size_t idx = PinNameToIndex(interruptNum);
@@ -28,7 +42,13 @@ void detachInterrupt(PinName interruptNum) {
 
 void detachInterrupt(pin_size_t interruptNum) {
   if ((interruptNum < PINS_COUNT) && (digitalPinToInterruptObj(interruptNum) != NULL)) {
-    delete digitalPinToInterruptObj(interruptNum);
+    mbed::InterruptIn* irq = digitalPinToInterruptObj(interruptNum);
+    digitalPinToInterruptObj(interruptNum) = NULL;
+    if (irq_pool.owns(irq)) {
+      irq_pool.destroy(irq);
+    } else {
+      delete irq;
+    }
   }
 }
 
@@ -37,7 +57,7 @@ void attachInterruptParam(PinName interruptNum, voidFuncPtrParam func, PinStatus
   if (idx != NOT_A_PIN) {
     attachInterruptParam(PinNameToIndex(interruptNum), func, mode, param);
   } else {
-    mbed::InterruptIn* irq = new mbed::InterruptIn(interruptNum);
+    mbed::InterruptIn* irq = new_irq(interruptNum);
     if (mode == CHANGE) {
       irq->rise(mbed::callback(func, param));
       irq->fall(mbed::callback(func, param));
@@ -58,7 +78,7 @@ void attachInterruptParam(pin_size_t interruptNum, voidFuncPtrParam func, PinSta
     return;
   }
   detachInterrupt(interruptNum);
-  mbed::InterruptIn* irq = new mbed::InterruptIn(digitalPinToPinName(interruptNum));
+  mbed::InterruptIn* irq = new_irq(digitalPinToPinName(interruptNum));
   if (mode == CHANGE) {
     irq->rise(mbed::callback(func, param));
     irq->fall(mbed::callback(func, param));
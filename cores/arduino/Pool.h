@@ -0,0 +1,166 @@
+/*
+  Pool.h - fixed block pool and arena allocators
+  Part of Arduino - http://www.arduino.cc/
+
+  Copyright (c) 2018-2019 Arduino SA
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include "platform/mbed_critical.h"
+
+#ifdef __cplusplus
+
+namespace arduino {
+
+// Room for N objects of type T, handed out and taken back in constant time
+// without touching the heap. create() returns NULL once all N are in use, so
+// callers can fall back to new. Safe from threads and interrupts; the
+// constructor is constexpr so a static pool is usable during static
+// initialisation
+template <typename T, size_t N>
+class Pool {
+	public:
+		constexpr Pool() : _blocks(), _free(nullptr), _unused(0) {}
+
+		void* allocate() {
+			core_util_critical_section_enter();
+			block* b = _free;
+			if (b != nullptr) {
+				_free = b->next;
+			} else if (_unused < N) {
+				b = &_blocks[_unused++];
+			}
+			core_util_critical_section_exit();
+			return b;
+		}
+
+		void deallocate(void* ptr) {
+			block* b = static_cast<block*>(ptr);
+			core_util_critical_section_enter();
+			b->next = _free;
+			_free = b;
+			core_util_critical_section_exit();
+		}
+
+		template <typename... Args>
+		T* create(Args&&... args) {
+			void* ptr = allocate();
+			return ptr != nullptr ? new (ptr) T(std::forward<Args>(args)...) : nullptr;
+		}
+
+		void destroy(T* obj) {
+			obj->~T();
+			deallocate(obj);
+		}
+
+		// True if ptr came from this pool rather than from the heap
+		bool owns(const void* ptr) const {
+			return ptr >= (const void*)&_blocks[0] && ptr < (const void*)&_blocks[N];
+		}
+
+	private:
+		union block {
+			block* next;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+		};
+
+		block _blocks[N];
+		block* _free;
+		size_t _unused;
+};
+
+// Bump allocator over a fixed buffer: allocate() only moves an offset, and
+// memory is only given back all at once, by reset() or when a Scope that was
+// opened earlier ends. Destructors are not run. Not thread safe, use one
+// arena per thread
+class Arena {
+	public:
+		Arena(void* buffer, size_t size) : _buffer(static_cast<uint8_t*>(buffer)), _size(size), _used(0) {}
+
+		void* allocate(size_t size, size_t align = alignof(max_align_t)) {
+			uintptr_t start = ((uintptr_t)_buffer + _used + align - 1) & ~(uintptr_t)(align - 1);
+			size_t offset = start - (uintptr_t)_buffer;
+			if (offset > _size || size > _size - offset) {
+				return nullptr;
+			}
+			_used = offset + size;
+			return (void*)start;
+		}
+
+		template <typename T, typename... Args>
+		T* create(Args&&... args) {
+			void* ptr = allocate(sizeof(T), alignof(T));
+			return ptr != nullptr ? new (ptr) T(std::forward<Args>(args)...) : nullptr;
+		}
+
+		void reset() {
+			_used = 0;
+		}
+
+		size_t used() const {
+			return _used;
+		}
+
+		size_t capacity() const {
+			return _size;
+		}
+
+		// Gives back everything allocated while it was in scope
+		class Scope {
+			public:
+				Scope(Arena& arena) : _arena(arena), _mark(arena._used) {}
+				~Scope() {
+					_arena._used = _mark;
+				}
+
+			private:
+				Scope(const Scope&) = delete;
+				Scope& operator=(const Scope&) = delete;
+
+				Arena& _arena;
+				size_t _mark;
+		};
+
+	private:
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		uint8_t* _buffer;
+		size_t _size;
+		size_t _used;
+};
+
+// Arena with its buffer inline
+template <size_t N>
+class ArenaN : public Arena {
+	public:
+		ArenaN() : Arena(_storage, N) {}
+
+	private:
+		alignas(max_align_t) uint8_t _storage[N];
+};
+
+}
+
+#endif
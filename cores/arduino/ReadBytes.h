@@ -0,0 +1,58 @@
+/*
+  ReadBytes.h - bulk readBytes() for streams with a buffered read
+  Part of Arduino - http://www.arduino.cc/
+
+  Copyright (c) 2018-2019 Arduino SA
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "api/Common.h"
+
+#ifdef __cplusplus
+
+namespace arduino {
+
+// Stream::readBytes() goes through timedRead() one byte at a time. This takes
+// whatever stream.read(buffer, length) has at once instead, and like
+// timedRead() gives up once nothing arrived for timeout ms.
+// Stream::readBytes() is not virtual, so a class that uses this for its own
+// readBytes() only speeds up calls made on that class, not through a Stream
+template <class T>
+size_t readBytesBulk(T& stream, uint8_t* buffer, size_t length, unsigned long timeout) {
+	size_t count = 0;
+	unsigned long start = millis();
+	while (count < length) {
+		size_t n = stream.read(&buffer[count], length - count);
+		if (n > 0) {
+			count += n;
+			start = millis();
+		} else if (millis() - start >= timeout) {
+			break;
+		} else {
+			yield();
+		}
+	}
+	return count;
+}
+
+}
+
+#endif
@@ -0,0 +1,245 @@
+/*
+  SPSCRingBuffer.h - lock-free single producer / single consumer byte ring
+  Part of Arduino - http://www.arduino.cc/
+
+  Copyright (c) 2018-2019 Arduino SA
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General
+  Public License along with this library; if not, write to the
+  Free Software Foundation, Inc., 59 Temple Place, Suite 330,
+  Boston, MA  02111-1307  USA
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+
+namespace arduino {
+
+// Byte ring shared by exactly one producer and one consumer, typically an
+// interrupt handler and a thread. Only the producer moves head and only the
+// consumer moves tail, so neither side needs a lock or a critical section.
+// The indices run free and are masked on access, so the size is a power of
+// two and the whole capacity is usable.
+class SPSCRingBuffer {
+	public:
+		SPSCRingBuffer() : _data(NULL), _owned(NULL), _mask(0), _head(0), _tail(0) {}
+		SPSCRingBuffer(uint8_t* storage, size_t size) : SPSCRingBuffer() {
+			attach(storage, size);
+		}
+		~SPSCRingBuffer() {
+			delete[] _owned;
+		}
+
+		// Capacity of a ring asked for size bytes, the next power of two
+		static size_t capacity_for(size_t size) {
+			size_t capacity = size ? 1 : 0;
+			while (capacity < size) {
+				capacity <<= 1;
+			}
+			return capacity;
+		}
+
+		// Heap storage for a ring asked for size bytes, NULL for 0. It is
+		// attached with capacity_for(size) and freed with delete[]
+		static uint8_t* allocate(size_t size) {
+			size_t capacity = capacity_for(size);
+			return capacity ? new uint8_t[capacity] : NULL;
+		}
+
+		// Replaces the storage with allocate(size), which the ring then owns
+		// until the next resize() or its destruction; 0 frees it. Neither side
+		// may be using the ring meanwhile
+		void resize(size_t size) {
+			uint8_t* storage = allocate(size);
+			attach(storage, capacity_for(size));
+			delete[] _owned;
+			_owned = storage;
+		}
+
+		// Uses the largest power of two that fits in size bytes of storage.
+		// Neither side may be using the ring meanwhile
+		void attach(uint8_t* storage, size_t size) {
+			size_t capacity = 0;
+			if (storage != NULL && size > 0) {
+				capacity = 1;
+				while (capacity <= size / 2) {
+					capacity <<= 1;
+				}
+			}
+			_data = capacity ? storage : NULL;
+			_mask = capacity ? capacity - 1 : 0;
+			_head.store(0, std::memory_order_relaxed);
+			_tail.store(0, std::memory_order_relaxed);
+		}
+
+		size_t capacity() const {
+			return _data ? _mask + 1 : 0;
+		}
+
+		// Consumer side
+
+		size_t available() const {
+			return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_relaxed);
+		}
+
+		int peek() const {
+			const uint8_t* span;
+			return read_span(span) ? *span : -1;
+		}
+
+		int read_char() {
+			const uint8_t* span;
+			if (read_span(span) == 0) {
+				return -1;
+			}
+			uint8_t c = *span;
+			commit_read(1);
+			return c;
+		}
+
+		size_t read(uint8_t* buffer, size_t len) {
+			size_t done = 0;
+			while (done < len) {
+				const uint8_t* span;
+				size_t n = read_span(span);
+				if (n == 0) {
+					break;
+				}
+				if (n > len - done) {
+					n = len - done;
+				}
+				memcpy(&buffer[done], span, n);
+				commit_read(n);
+				done += n;
+			}
+			return done;
+		}
+
+		// Points span at the oldest unread bytes and returns how many of them
+		// are contiguous; commit_read() hands them back to the producer
+		size_t read_span(const uint8_t*& span) const {
+			size_t tail = _tail.load(std::memory_order_relaxed);
+			size_t len = _head.load(std::memory_order_acquire) - tail;
+			if (len == 0) {
+				return 0;
+			}
+			size_t offset = tail & _mask;
+			span = &_data[offset];
+			return len < capacity() - offset ? len : capacity() - offset;
+		}
+
+		void commit_read(size_t len) {
+			_tail.store(_tail.load(std::memory_order_relaxed) + len, std::memory_order_release);
+		}
+
+		// Drops everything stored so far
+		void clear() {
+			_tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+		}
+
+		// Drops what was stored before a write_position() handed over by the
+		// producer, unless it has been read already
+		void skip_to(size_t position) {
+			size_t tail = _tail.load(std::memory_order_relaxed);
+			if (position - tail <= _head.load(std::memory_order_acquire) - tail) {
+				_tail.store(position, std::memory_order_release);
+			}
+		}
+
+		// Producer side
+
+		size_t availableForStore() const {
+			return capacity() - (_head.load(std::memory_order_relaxed) - _tail.load(std::memory_order_acquire));
+		}
+
+		bool store_char(uint8_t c) {
+			uint8_t* span;
+			if (write_span(span) == 0) {
+				return false;
+			}
+			*span = c;
+			commit_write(1);
+			return true;
+		}
+
+		size_t write(const uint8_t* buffer, size_t len) {
+			size_t done = 0;
+			while (done < len) {
+				uint8_t* span;
+				size_t n = write_span(span);
+				if (n == 0) {
+					break;
+				}
+				if (n > len - done) {
+					n = len - done;
+				}
+				memcpy(span, &buffer[done], n);
+				commit_write(n);
+				done += n;
+			}
+			return done;
+		}
+
+		// Points span at the free room after the newest byte and returns how
+		// much of it is contiguous; commit_write() publishes what was filled
+		size_t write_span(uint8_t*& span) const {
+			size_t head = _head.load(std::memory_order_relaxed);
+			size_t len = capacity() - (head - _tail.load(std::memory_order_acquire));
+			if (len == 0) {
+				return 0;
+			}
+			size_t offset = head & _mask;
+			span = &_data[offset];
+			return len < capacity() - offset ? len : capacity() - offset;
+		}
+
+		void commit_write(size_t len) {
+			_head.store(_head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+		}
+
+		// Where the next byte stored will go, for the consumer's skip_to()
+		size_t write_position() const {
+			return _head.load(std::memory_order_relaxed);
+		}
+
+	private:
+		uint8_t* _data;
+		uint8_t* _owned;
+		size_t _mask;
+		std::atomic<size_t> _head;
+		std::atomic<size_t> _tail;
+};
+
+// SPSCRingBuffer with its storage inline, the drop-in for RingBufferN<N>
+template <size_t N>
+class SPSCRingBufferN : public SPSCRingBuffer {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "SPSCRingBufferN size must be a power of two");
+
+	public:
+		SPSCRingBufferN() {
+			attach(_storage, N);
+		}
+
+	private:
+		uint8_t _storage[N];
+};
+
+}
+
+#endif
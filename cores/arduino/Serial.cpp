@@ -113,6 +113,17 @@ void UART::begin(unsigned long baudrate) {
 		_serial = new mbed_serial;
 		_serial->obj = NULL;
 	}
+	if (_serial->obj != NULL) {
+		// keep on_rx() away from rx_buffer while it is resized
+		_serial->obj->attach(nullptr, mbed::SerialBase::RxIrq);
+	}
+	if (rx_buffer.capacity() != SPSCRingBuffer::capacity_for(rx_buffer_size)) {
+		rx_buffer.resize(rx_buffer_size);
+	}
+	if (tx_buffer.capacity() != SPSCRingBuffer::capacity_for(tx_buffer_size)) {
+		flush();
+		tx_buffer.resize(tx_buffer_size);
+	}
 	if (_serial->obj == NULL) {
 		_serial->obj = new mbed::UnbufferedSerial(_tx, _rx, baudrate);
 	} else {
@@ -133,13 +144,26 @@ void UART::on_rx() {
 	}
 #endif
 	while(_serial->obj->readable()) {
-		char c;
-		core_util_critical_section_enter();
+		uint8_t c;
 		_serial->obj->read(&c, 1);
-		if (rx_buffer.availableForStore()) {
-			rx_buffer.store_char(c);
+		rx_buffer.store_char(c);
+	}
+}
+
+void UART::on_tx() {
+	// move bytes from the TX ring into the data register while it has room
+	const uint8_t* span;
+	size_t len;
+	while ((len = tx_buffer.read_span(span)) > 0 && _serial->obj->writeable()) {
+		size_t sent = 0;
+		while (sent < len && _serial->obj->writeable()) {
+			_serial->obj->write(&span[sent++], 1);
 		}
-		core_util_critical_section_exit();
+		tx_buffer.commit_read(sent);
+	}
+	if (tx_buffer.available() == 0 && tx_irq_enabled) {
+		_serial->obj->attach(nullptr, mbed::SerialBase::TxIrq);
+		tx_irq_enabled = false;
 	}
 }
 
@@ -150,12 +174,17 @@ void UART::end() {
 	}
 #endif
 	if (_serial != NULL && _serial->obj != NULL) {
+		flush();
+		_serial->obj->attach(nullptr, mbed::SerialBase::RxIrq);
+		_serial->obj->attach(nullptr, mbed::SerialBase::TxIrq);
+		tx_irq_enabled = false;
 		delete _serial->obj;
 		_serial->obj = NULL;
 		delete _serial;
 		_serial = NULL;
 	}
-	rx_buffer.clear();
+	rx_buffer.resize(0);
+	tx_buffer.resize(0);
 }
 
 int UART::available() {
@@ -164,10 +193,7 @@ int UART::available() {
 		return _SerialUSB.available();
 	}
 #endif
-	core_util_critical_section_enter();
-	int c = rx_buffer.available();
-	core_util_critical_section_exit();
-	return c;
+	return rx_buffer.available();
 }
 
 int UART::peek() {
@@ -176,10 +202,7 @@ int UART::peek() {
 		return _SerialUSB.peek();
 	}
 #endif
-	core_util_critical_section_enter();
-	int c = rx_buffer.peek();
-	core_util_critical_section_exit();
-	return c;
+	return rx_buffer.peek();
 }
 
 int UART::read() {
@@ -188,22 +211,58 @@ int UART::read() {
 		return _SerialUSB.read();
 	}
 #endif
-	core_util_critical_section_enter();
-	int c = rx_buffer.read_char();
-	core_util_critical_section_exit();
-	return c;
+	return rx_buffer.read_char();
+}
+
+size_t UART::read(uint8_t* buffer, size_t size) {
+#if defined(SERIAL_CDC)
+	if (is_usb) {
+		return _SerialUSB.read(buffer, size);
+	}
+#endif
+	return rx_buffer.read(buffer, size);
+}
+
+int UART::availableForWrite() {
+#if defined(SERIAL_CDC)
+	if (is_usb) {
+		return _SerialUSB.availableForWrite();
+	}
+#endif
+	if (_serial == NULL || _serial->obj == NULL) {
+		return 0;
+	}
+	if (tx_buffer.capacity() == 0) {
+		return _serial->obj->writeable() ? 1 : 0;
+	}
+	return tx_buffer.availableForStore();
+}
+
+void UART::setRxBufferSize(size_t size) {
+	rx_buffer_size = size;
+}
+
+void UART::setTxBufferSize(size_t size) {
+	tx_buffer_size = size;
 }
 
 void UART::flush() {
 #if defined(SERIAL_CDC)
 	if (is_usb) {
-		while(!_SerialUSB.writeable());
-	} else {
-		while(!_serial->obj->writeable());
+		_SerialUSB.flush();
+		return;
 	}
-#else
-	while(!_serial->obj->writeable());
 #endif
+	if (_serial == NULL || _serial->obj == NULL) {
+		return;
+	}
+	while (tx_buffer.available()) {
+		if (core_util_is_isr_active() || core_util_in_critical_section()) {
+			// the TX interrupt cannot run, drain by polling
+			on_tx();
+		}
+	}
+	while(!_serial->obj->writeable());
 }
 
 size_t UART::write(uint8_t c) {
@@ -212,6 +271,9 @@ size_t UART::write(uint8_t c) {
 		return _SerialUSB.write(c);
 	}
 #endif
+	if (tx_buffer.capacity()) {
+		return write(&c, 1);
+	}
 	while (!_serial->obj->writeable()) {}
 	int ret = _serial->obj->write(&c, 1);
 	return ret == -1 ? 0 : 1;
@@ -223,6 +285,44 @@ size_t UART::write(const uint8_t* c, size_t len) {
 		return _SerialUSB.write(c, len);
 	}
 #endif
+	if (tx_buffer.capacity()) {
+		// the ring takes one producer: threads queue on the mutex, an
+		// interrupt cannot block and keeps others out for the whole write
+		bool isr = core_util_is_isr_active() || core_util_in_critical_section();
+		if (isr) {
+			core_util_critical_section_enter();
+		} else {
+			tx_mutex.lock();
+		}
+		size_t sent = 0;
+		while (sent < len) {
+			if (isr) {
+				sent += tx_buffer.write(&c[sent], len - sent);
+			} else {
+				// an interrupt may write too, keep it out while storing
+				core_util_critical_section_enter();
+				sent += tx_buffer.write(&c[sent], len - sent);
+				core_util_critical_section_exit();
+			}
+			// on_tx() only turns the interrupt off after finding the ring
+			// empty, so whatever was just stored is either seen by it or
+			// gets the interrupt turned back on here
+			if (!tx_irq_enabled) {
+				tx_irq_enabled = true;
+				_serial->obj->attach(mbed::callback(this, &UART::on_tx), mbed::SerialBase::TxIrq);
+			}
+			if (sent < len && isr) {
+				// ring full and the TX interrupt cannot run, drain by polling
+				on_tx();
+			}
+		}
+		if (isr) {
+			core_util_critical_section_exit();
+		} else {
+			tx_mutex.unlock();
+		}
+		return len;
+	}
 	while (!_serial->obj->writeable()) {}
 	_serial->obj->set_blocking(true);
 	int ret = _serial->obj->write(c, len);
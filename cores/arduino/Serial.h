@@ -22,9 +22,12 @@
 
 #include "api/RingBuffer.h"
 #include "Arduino.h"
+#include "SPSCRingBuffer.h"
+#include "ReadBytes.h"
 #include "api/HardwareSerial.h"
 #include "PinNames.h"
 #include <platform/FileHandle.h>
+#include <platform/PlatformMutex.h>
 
 #ifdef __cplusplus
 
@@ -53,6 +56,21 @@ class UART : public HardwareSerial {
 		size_t write(uint8_t c);
 		size_t write(const uint8_t*, size_t);
 		using Print::write; // pull in write(str) and write(buf, size) from Print
+		size_t read(uint8_t* buffer, size_t size);
+		// Bulk, see readBytesBulk(); only for calls made on a UART, as
+		// Stream::readBytes() is not virtual
+		size_t readBytes(char* buffer, size_t length) {
+			return readBytesBulk(*this, (uint8_t*)buffer, length, _timeout);
+		}
+		size_t readBytes(uint8_t* buffer, size_t length) {
+			return readBytesBulk(*this, buffer, length, _timeout);
+		}
+		int availableForWrite(void);
+		// Buffer sizes are rounded up to a power of two and applied by the
+		// next begin(). With a TX buffer, write() only copies into it and
+		// the TX interrupt drains it
+		void setRxBufferSize(size_t size);
+		void setTxBufferSize(size_t size);
 		operator bool();
 		operator mbed::FileHandle*();	// exposes the internal mbed object
 
@@ -67,6 +85,7 @@ class UART : public HardwareSerial {
 
 	private:
 		void on_rx();
+		void on_tx();
 		void block_tx(int);
 		bool _block;
 		// See https://github.com/ARMmbed/mbed-os/blob/f5b5989fc81c36233dbefffa1d023d1942468d42/targets/TARGET_NORDIC/TARGET_NRF5x/TARGET_NRF52/serial_api.c#L76
@@ -74,7 +93,16 @@ class UART : public HardwareSerial {
 		mbed_serial* _serial = NULL;
 		mbed_usb_serial* _usb_serial = NULL;
 		PinName _tx, _rx, _rts, _cts;
-		RingBufferN<256> rx_buffer;
+		// on_rx() produces into rx_buffer and on_tx() consumes tx_buffer,
+		// the thread using the port is the other side of both. Writers to
+		// tx_buffer are made a single producer by tx_mutex in threads and a
+		// critical section in interrupts
+		SPSCRingBuffer rx_buffer;
+		SPSCRingBuffer tx_buffer;
+		PlatformMutex tx_mutex;
+		size_t rx_buffer_size = 256;
+		size_t tx_buffer_size = 0;
+		volatile bool tx_irq_enabled = false;
 		uint8_t intermediate_buf[4];
 		bool is_usb = false;
 };
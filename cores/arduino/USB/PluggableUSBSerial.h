@@ -20,7 +20,10 @@
 
 #include "Arduino.h"
 #include "USBCDC.h"
+#include "SPSCRingBuffer.h"
+#include "ReadBytes.h"
 #include "platform/Stream.h"
+#include "drivers/Timeout.h"
 #include "rtos/rtos.h"
 #include "Callback.h"
 
@@ -47,6 +50,16 @@
 
 #define MAX_CALLBACKS_ON_IRQ    4
 
+// Default transmit buffer, small writes are gathered into whole packets
+#ifndef SERIAL_CDC_TX_BUFFER_SIZE
+#define SERIAL_CDC_TX_BUFFER_SIZE    (4 * CDC_MAX_PACKET_SIZE)
+#endif
+
+// How long a partly filled packet waits for more data before it is sent
+#ifndef SERIAL_CDC_TX_FLUSH_US
+#define SERIAL_CDC_TX_FLUSH_US       1000
+#endif
+
 namespace arduino {
 
 
@@ -222,49 +235,60 @@ public:
 
     int available(void) {
         USBCDC::lock();
-        onInterrupt();
-        auto ret = rx_buffer.available();
+        auto ret = receive_available();
         USBCDC::unlock();
         return ret;
     }
 
     int peek(void) {
         USBCDC::lock();
-        onInterrupt();
-        auto ret = rx_buffer.peek();
+        auto ret = receive_peek();
         USBCDC::unlock();
         return ret;
     }
 
     int read(void) {
+        uint8_t c;
+        return read(&c, 1) ? c : -1;
+    }
+
+    // Copies straight out of the packets the endpoint received into
+    size_t read(uint8_t* buf, size_t size) {
+        uint32_t actual;
         USBCDC::lock();
-        onInterrupt();
-        auto ret = rx_buffer.read_char();
+        receive_nb(buf, size, &actual);
         USBCDC::unlock();
-        return ret;
+        return actual;
     }
 
-    void flush(void) {}
+    // Bulk, see readBytesBulk(); only for calls made on a USBSerial, as
+    // Stream::readBytes() is not virtual
+    size_t readBytes(char* buffer, size_t length) {
+        return readBytesBulk(*this, (uint8_t*)buffer, length, _timeout);
+    }
+    size_t readBytes(uint8_t* buffer, size_t length) {
+        return readBytesBulk(*this, buffer, length, _timeout);
+    }
 
-    size_t write(uint8_t c) {
+    int availableForWrite(void) {
         if (!connected()) {
             return 0;
         }
-        return _putc(c);
+        // without a TX buffer write() blocks on one packet at a time
+        return tx_ring.capacity() ? tx_ring.availableForStore() : CDC_MAX_PACKET_SIZE;
     }
 
-    size_t write(const uint8_t* buf, size_t size) {
-        if (!connected()) {
-            return 0;
-        }
-        size_t sent = 0;
-        while (sent < size) {
-            size_t to_send = (size - sent) > CDC_MAX_PACKET_SIZE ? CDC_MAX_PACKET_SIZE : (size - sent);
-            send((uint8_t*)&buf[sent], to_send);
-            sent += to_send;
-        }
-        return sent;
+    // Waits until everything written has gone out
+    void flush(void);
+
+    size_t write(uint8_t c) {
+        return write(&c, 1);
     }
+
+    // With a TX buffer, write() only waits when it is full; a packet goes
+    // out once it is full, SERIAL_CDC_TX_FLUSH_US after the first byte of
+    // it was written, or on flush()
+    size_t write(const uint8_t* buf, size_t size);
     using Print::write; // pull in write(str) and write(buf, size) from Print
 
     operator bool() {
@@ -292,27 +316,30 @@ public:
         return (_rts != 0);
     }
 
+    // Applied by the next begin(), 0 sends straight from write()
+    void setTxBufferSize(size_t size) {
+        tx_buffer_size = size;
+    }
+
 private:
-    RingBufferN<256> rx_buffer;
-    rtos::Thread* t;
     int _baud, _bits, _parity, _stop;
 
-    void onInterrupt() {
-        uint8_t buf[256];
-        int howMany = _available();
-        uint32_t toRead;
-        if (howMany > rx_buffer.availableForStore()) {
-            howMany = rx_buffer.availableForStore();
-        }
-        receive_nb(buf, howMany, &toRead);
-        while (rx_buffer.availableForStore() && toRead > 0) {
-            rx_buffer.store_char(buf[howMany-toRead]);
-            toRead --;
-        }
-    }
+    // Filled by write(), drained into the endpoint buffer with the USB lock
+    // held, from threads, the endpoint interrupt and tx_timer
+    SPSCRingBuffer tx_ring;
+    uint8_t* tx_storage = NULL;
+    size_t tx_buffer_size = SERIAL_CDC_TX_BUFFER_SIZE;
+    ::mbed::Timeout tx_timer;
+    bool tx_timer_armed = false;
+    // set whenever a packet has gone out
+    rtos::EventFlags tx_event;
+
+    void tx_kick(bool partial);
+    void tx_timeout();
 
 protected:
     virtual void data_rx();
+    virtual void data_tx();
     virtual void line_coding_changed(int baud, int bits, int parity, int stop)
     {
         USBCDC::assert_locked();
@@ -32,6 +32,8 @@ static const uint8_t cdc_line_coding_default[7] = {0x80, 0x25, 0x00, 0x00, 0x00,
 
 #define DEFAULT_CONFIGURATION (1)
 
+static_assert((CDC_RX_PACKETS & (CDC_RX_PACKETS - 1)) == 0, "CDC_RX_PACKETS must be a power of two");
+
 #define CDC_SET_LINE_CODING        0x20
 #define CDC_GET_LINE_CODING        0x21
 #define CDC_SET_CONTROL_LINE_STATE 0x22
@@ -181,8 +183,9 @@ void USBCDC::init(EndpointResolver& resolver)
     _tx_size = 0;
 
     _rx_in_progress = false;
-    _rx_buf = _rx_buffer;
-    _rx_size = 0;
+    _rx_head = 0;
+    _rx_tail = 0;
+    _rx_offset = 0;
 }
 
 void USBCDC::callback_reset()
@@ -294,8 +297,7 @@ bool USBCDC::callback_set_configuration(uint8_t configuration)
     PluggableUSBD().endpoint_add(_bulk_in, CDC_MAX_PACKET_SIZE, USB_EP_TYPE_BULK, ::mbed::callback(this, &USBCDC::_send_isr));
     PluggableUSBD().endpoint_add(_bulk_out, CDC_MAX_PACKET_SIZE, USB_EP_TYPE_BULK, ::mbed::callback(this, &USBCDC::_receive_isr));
 
-    PluggableUSBD().read_start(_bulk_out, _rx_buf, sizeof(_rx_buffer));
-    _rx_in_progress = true;
+    _receive_isr_start();
 
     ret = true;
 
@@ -325,14 +327,17 @@ void USBCDC::_change_terminal_connected(bool connected)
 
         // Abort RX
         if (_rx_in_progress) {
-            PluggableUSBD().endpoint_abort(_bulk_in);
+            PluggableUSBD().endpoint_abort(_bulk_out);
             _rx_in_progress = false;
         }
-        _rx_buf = _rx_buffer;
-        _rx_size = 0;
+        _rx_head = 0;
+        _rx_tail = 0;
+        _rx_offset = 0;
         _rx_list.process();
         MBED_ASSERT(_rx_list.empty());
 
+    } else {
+        _receive_isr_start();
     }
     _connected_list.process();
 }
@@ -381,7 +386,7 @@ void USBCDC::send_nb(uint8_t *buffer, uint32_t size, uint32_t *actual, bool now)
         uint32_t free = sizeof(_tx_buffer) - _tx_size;
         uint32_t write_size = free > size ? size : free;
         if (size > 0) {
-            memcpy(_tx_buf, buffer, write_size);
+            memcpy(&_tx_buf[_tx_size], buffer, write_size);
         }
         _tx_size += write_size;
         *actual = write_size;
@@ -444,25 +449,54 @@ void USBCDC::receive_nb(uint8_t *buffer, uint32_t size,  uint32_t *size_read)
 {
 
     *size_read = 0;
-    if (_terminal_connected && !_rx_in_progress) {
+    if (!_terminal_connected) {
+        return;
+    }
+    while (*size_read < size && _rx_tail != _rx_head) {
         // Copy data over
-        uint32_t copy_size = _rx_size > size ? size : _rx_size;
-        memcpy(buffer, _rx_buf, copy_size);
-        *size_read = copy_size;
-        _rx_buf += copy_size;
-        _rx_size -= copy_size;
-        if (_rx_size == 0) {
-            _receive_isr_start();
+        uint32_t packet = _rx_tail % CDC_RX_PACKETS;
+        uint32_t copy_size = _rx_sizes[packet] - _rx_offset;
+        if (copy_size > size - *size_read) {
+            copy_size = size - *size_read;
         }
+        memcpy(&buffer[*size_read], &_rx_buffer[packet][_rx_offset], copy_size);
+        *size_read += copy_size;
+        _rx_offset += copy_size;
+        if (_rx_offset == _rx_sizes[packet]) {
+            _rx_tail++;
+            _rx_offset = 0;
+        }
+    }
+    if (*size_read > 0) {
+        // a packet may have come free while the endpoint had none
+        _receive_isr_start();
+    }
+}
+
+uint32_t USBCDC::receive_available()
+{
+    uint32_t size = 0;
+    for (uint32_t i = _rx_tail; i != _rx_head; i++) {
+        size += _rx_sizes[i % CDC_RX_PACKETS];
     }
+    return size - _rx_offset;
+}
+
+int USBCDC::receive_peek()
+{
+    if (!_terminal_connected || _rx_tail == _rx_head) {
+        return -1;
+    }
+    return _rx_buffer[_rx_tail % CDC_RX_PACKETS][_rx_offset];
 }
 
 void USBCDC::_receive_isr_start()
 {
-    if ((_rx_size == 0) && !_rx_in_progress) {
+    if (!_rx_in_progress && _rx_head - _rx_tail < CDC_RX_PACKETS) {
         // Refill the buffer
-        PluggableUSBD().read_start(_bulk_out, _rx_buffer, sizeof(_rx_buffer));
-        _rx_in_progress = true;
+        if (PluggableUSBD().read_start(_bulk_out, _rx_buffer[_rx_head % CDC_RX_PACKETS], CDC_MAX_PACKET_SIZE)) {
+            _rx_in_progress = true;
+        }
     }
 }
 
@@ -474,12 +508,16 @@ void USBCDC::_receive_isr()
 {
     assert_locked();
 
-    MBED_ASSERT(_rx_size == 0);
-    _rx_buf = _rx_buffer;
-    _rx_size = PluggableUSBD().read_finish(_bulk_out);
+    uint32_t size = PluggableUSBD().read_finish(_bulk_out);
     _rx_in_progress = false;
+    if (size > 0) {
+        _rx_sizes[_rx_head % CDC_RX_PACKETS] = size;
+        _rx_head++;
+    }
+    // take the next packet right away if there is room for it
+    _receive_isr_start();
     _rx_list.process();
-    if (!_rx_in_progress) {
+    if (_rx_tail != _rx_head) {
         data_rx();
     }
 
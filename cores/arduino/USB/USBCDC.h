@@ -32,6 +32,12 @@
 #define CDC_MAX_PACKET_SIZE    64
 #endif
 
+// Packets the bulk OUT endpoint can receive ahead of the application, a
+// power of two
+#ifndef CDC_RX_PACKETS
+#define CDC_RX_PACKETS         4
+#endif
+
 class AsyncOp;
 
 namespace arduino {
@@ -135,6 +141,16 @@ public:
      */
     void receive_nb(uint8_t *buffer, uint32_t size, uint32_t *actual);
 
+    /**
+     * Number of received bytes not read yet
+     */
+    uint32_t receive_available();
+
+    /**
+     * Next received byte without reading it, or -1 if there is none
+     */
+    int receive_peek();
+
 protected:
 
     /*
@@ -228,11 +244,16 @@ protected:
     uint8_t *_tx_buf;
     uint32_t _tx_size;
 
+    // The endpoint receives straight into the packet at _rx_head and is
+    // armed again from the interrupt while one is free; readers consume
+    // from _rx_tail, _rx_offset bytes into it
     OperationList<AsyncRead> _rx_list;
     bool _rx_in_progress;
-    uint8_t _rx_buffer[CDC_MAX_PACKET_SIZE];
-    uint8_t *_rx_buf;
-    uint32_t _rx_size;
+    uint8_t _rx_buffer[CDC_RX_PACKETS][CDC_MAX_PACKET_SIZE];
+    uint32_t _rx_sizes[CDC_RX_PACKETS];
+    uint32_t _rx_head;
+    uint32_t _rx_tail;
+    uint32_t _rx_offset;
 
     const char* extraDescriptor;
 };
@@ -26,24 +26,25 @@
 
 using namespace arduino;
 
-static rtos::EventFlags event;
+using namespace std::chrono_literals;
 
-static void waitForPortClose() {
+static mbed::Timeout touch_timeout;
 
-    event.wait_any(0xFF);
-    // wait for DTR be 0 (port closed) and timeout to be over
-    long start = millis();
-    static const int WAIT_TIMEOUT = 200;
-    while (_SerialUSB.connected() || (millis() - start) < WAIT_TIMEOUT) {
-        // the delay is needed to handle other "concurrent" IRQ events
-        delay(1);
+// Runs from the timer interrupt: once the host has closed the port it
+// opened at 1200 baud, reset into the bootloader
+static void touchCheck() {
+    if (_SerialUSB.connected()) {
+        touch_timeout.attach(touchCheck, 1ms);
+        return;
     }
     _ontouch1200bps_();
 }
 
 void usbPortChanged(int baud, int bits, int parity, int stop) {
     if (baud == 1200) {
-        event.set(1);
+        // wait for DTR be 0 (port closed) and timeout to be over
+        static const auto WAIT_TIMEOUT = 200ms;
+        touch_timeout.attach(touchCheck, WAIT_TIMEOUT);
     }
 }
 
@@ -65,25 +66,139 @@ USBSerial::USBSerial(USBPhy *phy, uint16_t vendor_id, uint16_t product_id, uint1
 
 USBSerial::~USBSerial()
 {
+    tx_timer.detach();
+    delete[] tx_storage;
 }
 
 void USBSerial::begin(unsigned long) {
+    size_t capacity = SPSCRingBuffer::capacity_for(tx_buffer_size);
+    if (tx_ring.capacity() != capacity) {
+        // allocate outside the USB lock, it is a critical section
+        uint8_t* storage = SPSCRingBuffer::allocate(tx_buffer_size);
+        USBCDC::lock();
+        tx_ring.attach(storage, capacity);
+        USBCDC::unlock();
+        delete[] tx_storage;
+        tx_storage = storage;
+    }
     this->attach(usbPortChanged);
-    this->attach(::mbed::callback(this, &USBSerial::onInterrupt));
-    t = new rtos::Thread(osPriorityNormal, 256, nullptr, "USBevt");
-    t->start(waitForPortClose);
-    onInterrupt();
 }
 
 int USBSerial::_putc(int c)
 {
-    if (send((uint8_t *)&c, 1)) {
+    uint8_t b = c;
+    if (write(&b, 1) == 1) {
         return c;
     } else {
         return -1;
     }
 }
 
+size_t USBSerial::write(const uint8_t* buf, size_t size)
+{
+    if (!connected()) {
+        // drop what was left from the last connection
+        USBCDC::lock();
+        tx_ring.clear();
+        USBCDC::unlock();
+        return 0;
+    }
+    if (tx_ring.capacity() == 0) {
+        size_t sent = 0;
+        while (sent < size) {
+            size_t to_send = (size - sent) > CDC_MAX_PACKET_SIZE ? CDC_MAX_PACKET_SIZE : (size - sent);
+            send((uint8_t*)&buf[sent], to_send);
+            sent += to_send;
+        }
+        return sent;
+    }
+
+    size_t queued = 0;
+    while (queued < size) {
+        tx_event.clear();
+        USBCDC::lock();
+        if (_terminal_connected) {
+            queued += tx_ring.write(&buf[queued], size - queued);
+            tx_kick(false);
+        }
+        USBCDC::unlock();
+        if (queued == size || !connected() || core_util_is_isr_active() || core_util_in_critical_section()) {
+            break;
+        }
+        // full, wait for a packet to go out
+        tx_event.wait_any(1, 10);
+    }
+    return queued;
+}
+
+void USBSerial::flush()
+{
+    while (connected()) {
+        tx_event.clear();
+        USBCDC::lock();
+        tx_kick(true);
+        bool done = tx_ring.available() == 0 && !_tx_in_progress;
+        USBCDC::unlock();
+        if (done || core_util_is_isr_active() || core_util_in_critical_section()) {
+            return;
+        }
+        tx_event.wait_any(1, 10);
+    }
+}
+
+// Moves up to a packet from tx_ring into the endpoint buffer and starts
+// it, unless it would be a short one and partial is not set; that one gets
+// tx_timer instead
+void USBSerial::tx_kick(bool partial)
+{
+    USBCDC::assert_locked();
+
+    if (_tx_in_progress || !_terminal_connected) {
+        return;
+    }
+    size_t pending = tx_ring.available();
+    if (pending == 0) {
+        return;
+    }
+    if (pending < CDC_MAX_PACKET_SIZE && !partial) {
+        if (!tx_timer_armed) {
+            tx_timer_armed = true;
+            tx_timer.attach(::mbed::callback(this, &USBSerial::tx_timeout), std::chrono::microseconds(SERIAL_CDC_TX_FLUSH_US));
+        }
+        return;
+    }
+    while (_tx_size < CDC_MAX_PACKET_SIZE) {
+        const uint8_t* span;
+        size_t len = tx_ring.read_span(span);
+        if (len == 0) {
+            break;
+        }
+        uint32_t actual;
+        send_nb((uint8_t*)span, len, &actual, false);
+        tx_ring.commit_read(actual);
+        if (actual < len) {
+            break;
+        }
+    }
+    _send_isr_start();
+}
+
+void USBSerial::tx_timeout()
+{
+    USBCDC::lock();
+    tx_timer_armed = false;
+    tx_kick(true);
+    USBCDC::unlock();
+}
+
+void USBSerial::data_tx()
+{
+    USBCDC::assert_locked();
+
+    tx_kick(false);
+    tx_event.set(1);
+}
+
 int USBSerial::_getc()
 {
     uint8_t c = 0;
@@ -112,10 +227,7 @@ uint32_t USBSerial::_available()
 {
     USBCDC::lock();
 
-    uint32_t size = 0;
-    if (!_rx_in_progress) {
-        size = _rx_size > CDC_MAX_PACKET_SIZE ? CDC_MAX_PACKET_SIZE : _rx_size;
-    }
+    uint32_t size = receive_available();
 
     USBCDC::unlock();
     return size;
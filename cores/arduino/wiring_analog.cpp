@@ -23,6 +23,30 @@
 #include "Arduino.h"
 #include "pins_arduino.h"
 #include "pinDefinitions.h"
+#include "Pool.h"
+
+// PWM objects for the first pins used come from a static pool, further ones
+// from the heap
+#ifndef PWM_POOL_SIZE
+#define PWM_POOL_SIZE 8
+#endif
+
+static arduino::Pool<mbed::PwmOut, PWM_POOL_SIZE> pwm_pool;
+
+static mbed::PwmOut* new_pwm(PinName pin)
+{
+  mbed::PwmOut* pwm = pwm_pool.create(pin);
+  return pwm != NULL ? pwm : new mbed::PwmOut(pin);
+}
+
+static void delete_pwm(mbed::PwmOut* pwm)
+{
+  if (pwm_pool.owns(pwm)) {
+    pwm_pool.destroy(pwm);
+  } else {
+    delete pwm;
+  }
+}
 
 static int write_resolution = 8;
 static int read_resolution = 10;
@@ -48,7 +72,7 @@ void analogWrite(PinName pin, int val)
   if (idx != NOT_A_PIN) {
     analogWrite(idx, val);
   } else {
-    mbed::PwmOut* pwm = new mbed::PwmOut(pin);
+    mbed::PwmOut* pwm = new_pwm(pin);
     pwm->period_ms(2); //500Hz
     float percent = (float)val/(float)((1 << write_resolution)-1);
     pwm->write(percent);
@@ -69,12 +93,12 @@ void analogWrite(pin_size_t pin, int val)
   float percent = (float)val/(float)((1 << write_resolution)-1);
   mbed::PwmOut* pwm = digitalPinToPwm(pin);
   if (pwm == NULL) {
-    pwm = new mbed::PwmOut(digitalPinToPinName(pin));
+    pwm = new_pwm(digitalPinToPinName(pin));
     digitalPinToPwm(pin) = pwm;
     pwm->period_ms(2); //500Hz
   }
   if (percent < 0) {
-    delete pwm;
+    delete_pwm(pwm);
     digitalPinToPwm(pin) = NULL;
   } else {
     pwm->write(percent);
@@ -24,6 +24,22 @@
 #include "pins_arduino.h"
 #include "mbed.h"
 #include "pinDefinitions.h"
+#include "Pool.h"
+
+// GPIO objects for the first pins used come from a static pool, further ones
+// from the heap
+#ifndef GPIO_POOL_SIZE
+#define GPIO_POOL_SIZE 16
+#endif
+
+static arduino::Pool<mbed::DigitalInOut, GPIO_POOL_SIZE> gpio_pool;
+
+template <typename... Args>
+static mbed::DigitalInOut* new_gpio(Args... args)
+{
+  mbed::DigitalInOut* gpio = gpio_pool.create(args...);
+  return gpio != NULL ? gpio : new mbed::DigitalInOut(args...);
+}
 
 void pinMode(PinName pin, PinMode mode)
 {
@@ -51,12 +67,12 @@ void pinMode(PinName pin, PinMode mode)
 
 void pinMode(pin_size_t pin, PinMode mode)
 {
+  // an existing object is only reconfigured
   mbed::DigitalInOut* gpio = digitalPinToGpio(pin);
-  if (gpio != NULL) {
-    delete gpio;
+  if (gpio == NULL) {
+    gpio = new_gpio(digitalPinToPinName(pin));
+    digitalPinToGpio(pin) = gpio;
   }
-  gpio = new mbed::DigitalInOut(digitalPinToPinName(pin));
-  digitalPinToGpio(pin) = gpio;
 
   switch (mode) {
     case INPUT:
@@ -95,7 +111,7 @@ void digitalWrite(pin_size_t pin, PinStatus val)
   }
   mbed::DigitalInOut* gpio = digitalPinToGpio(pin);
   if (gpio == NULL) {
-    gpio = new mbed::DigitalInOut(digitalPinToPinName(pin), PIN_OUTPUT, PullNone, val);
+    gpio = new_gpio(digitalPinToPinName(pin), PIN_OUTPUT, PullNone, (int)val);
     digitalPinToGpio(pin) = gpio;
   }
   gpio->write(val);
@@ -118,7 +134,7 @@ PinStatus digitalRead(pin_size_t pin)
   }  
   mbed::DigitalInOut* gpio = digitalPinToGpio(pin);
   if (gpio == NULL) {
-    gpio = new mbed::DigitalInOut(digitalPinToPinName(pin), PIN_INPUT, PullNone, 0);
+    gpio = new_gpio(digitalPinToPinName(pin), PIN_INPUT, PullNone, 0);
     digitalPinToGpio(pin) = gpio;
   }
   return (PinStatus) gpio->read();
@@ -2,17 +2,9 @@
 
 arduino::EthernetClient arduino::EthernetServer::available(uint8_t* status) {
   EthernetClient client;
-  nsapi_error_t error;
-
-  if (sock == nullptr) {
-    return client;
-  }
-  TCPSocket* clientSocket = sock->accept(&error);
+  bool found = nextClient(client);
   if (status != nullptr) {
-    *status = error == NSAPI_ERROR_OK ? 1 : 0;
-  }
-  if (error == NSAPI_ERROR_OK) {
-    client.setSocket(clientSocket);
+    *status = found ? 1 : 0;
   }
   return client;
 }
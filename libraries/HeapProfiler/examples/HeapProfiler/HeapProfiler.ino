@@ -0,0 +1,33 @@
+/* This example prints a heap profile every ten seconds.
+
+   The reports are binary, decode them on the host with
+
+   python3 libraries/HeapProfiler/extras/heap_profile.py {debug.port} --follow --elf {project_name}.elf
+
+   On the Portenta H7 M4 core pass SerialRPC to report() instead, and read
+   the reports from the M7 side.
+*/
+
+#include <HeapProfiler.h>
+
+void setup() {
+  HeapProfiler.begin();
+  Serial.begin(115200);
+}
+
+void loop() {
+  static unsigned long last;
+  static String text;
+
+  // something that keeps reallocating
+  text += "heap";
+  if (text.length() > 200) {
+    text = "";
+  }
+  delay(10);
+
+  if (millis() - last > 10000) {
+    last = millis();
+    HeapProfiler.report(Serial);
+  }
+}
@@ -0,0 +1,154 @@
+#!/usr/bin/env python3
+"""Decodes the binary reports written by HeapProfiler.report().
+
+Reads a capture file, or a serial port when pyserial is installed, skips any
+text around the reports and prints one table per report. With --elf the call
+sites are resolved to functions and lines through addr2line.
+
+  heap_profile.py capture.bin --elf sketch.ino.elf
+  heap_profile.py /dev/ttyACM0 --follow --sort peak
+"""
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+
+MAGIC = b"HPRF"
+VERSION = 1
+LIFETIME_BUCKETS = 8
+HEADER = struct.Struct("<BHIIIIII")
+SITE = struct.Struct("<IBIIIIIII%dI" % LIFETIME_BUCKETS)
+LIFETIME_LABELS = ["<1ms", "<8ms", "<64ms", "<.5s", "<4s", "<33s", "<4m", "longer"]
+REGIONS = {0x0: "itcm", 0x2: "ram", 0x3: "ram_d2", 0x6: "sdram", 0xC: "sdram", 0xD: "sdram", 0xFF: "-"}
+
+
+def fletcher16(data):
+    sum1 = sum2 = 0
+    for b in data:
+        sum1 = (sum1 + b) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def parse(buf):
+    """Yields (report, rest) for every complete report in buf."""
+    while True:
+        start = buf.find(MAGIC)
+        if start < 0:
+            return
+        body = buf[start + len(MAGIC):]
+        if len(body) < HEADER.size:
+            return
+        version, count, uptime, live, peak, untracked, dropped_sites, dropped_live = HEADER.unpack_from(body)
+        size = HEADER.size + count * SITE.size
+        if version != VERSION:
+            buf = body
+            continue
+        if len(body) < size + 2:
+            return
+        checksum, = struct.unpack_from("<H", body, size)
+        if checksum != fletcher16(body[:size]):
+            buf = body
+            continue
+        sites = []
+        for i in range(count):
+            fields = SITE.unpack_from(body, HEADER.size + i * SITE.size)
+            site = dict(zip(("caller", "region", "allocs", "frees", "failures", "bytes",
+                             "live", "peak", "max"), fields[:9]))
+            site["lifetime"] = fields[9:]
+            sites.append(site)
+        report = {
+            "uptime": uptime, "live": live, "peak": peak, "untracked": untracked,
+            "dropped_sites": dropped_sites, "dropped_live": dropped_live, "sites": sites,
+        }
+        yield report, body[size + 2:]
+        buf = body[size + 2:]
+
+
+class Symbolizer:
+    def __init__(self, elf, addr2line):
+        self.elf = elf
+        self.addr2line = addr2line
+        self.cache = {}
+
+    def __call__(self, addr):
+        if not self.elf:
+            return ""
+        if addr not in self.cache:
+            # addr is a return address, ask for the call instruction before it
+            try:
+                out = subprocess.run([self.addr2line, "-f", "-C", "-s", "-e", self.elf, "%x" % max(addr - 1, 0)],
+                                     capture_output=True, text=True, check=True).stdout.split("\n")
+                self.cache[addr] = "%s %s" % (out[0], out[1])
+            except (OSError, subprocess.CalledProcessError, IndexError):
+                self.cache[addr] = "?"
+        return self.cache[addr]
+
+
+def show(report, symbolize, sort_key, out=sys.stdout):
+    out.write("uptime %.1fs  live %d B  peak %d B  untracked frees %d  dropped sites %d  dropped live %d\n" % (
+        report["uptime"] / 1000.0, report["live"], report["peak"], report["untracked"],
+        report["dropped_sites"], report["dropped_live"]))
+    out.write("%-10s %-6s %8s %8s %5s %10s %8s %8s %7s  %-40s %s\n" % (
+        "caller", "region", "allocs", "frees", "fail", "bytes", "live", "peak", "max",
+        " ".join("%5s" % label for label in LIFETIME_LABELS), "where"))
+    for site in sorted(report["sites"], key=lambda s: s[sort_key], reverse=True):
+        if site["region"] == 0xFF and site["allocs"] == 0 and site["failures"] == 0:
+            continue
+        out.write("0x%08x %-6s %8d %8d %5d %10d %8d %8d %7d  %-40s %s\n" % (
+            site["caller"], REGIONS.get(site["region"], "0x%x" % site["region"]), site["allocs"],
+            site["frees"], site["failures"], site["bytes"], site["live"], site["peak"], site["max"],
+            " ".join("%5d" % n for n in site["lifetime"]), symbolize(site["caller"])))
+    out.write("\n")
+
+
+def open_source(path, baud):
+    if os.path.isfile(path) or path == "-":
+        return open(path, "rb") if path != "-" else sys.stdin.buffer
+    try:
+        import serial
+    except ImportError:
+        sys.exit("reading from %s needs pyserial (pip install pyserial)" % path)
+    return serial.Serial(path, baud, timeout=1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="capture file, - for stdin, or a serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--elf", help="sketch .elf to resolve call sites with")
+    parser.add_argument("--addr2line", default="arm-none-eabi-addr2line")
+    parser.add_argument("--sort", default="peak",
+                        choices=["peak", "live", "allocs", "bytes", "failures", "max"])
+    parser.add_argument("--follow", action="store_true", help="keep reading and print every report")
+    args = parser.parse_args()
+
+    symbolize = Symbolizer(args.elf, args.addr2line)
+    source = open_source(args.source, args.baud)
+    buf = b""
+    last = None
+    while True:
+        chunk = source.read(4096)
+        if not chunk:
+            # a serial port times out, a file ends
+            if args.follow and hasattr(source, "in_waiting"):
+                continue
+            break
+        buf += chunk
+        for report, buf in parse(buf):
+            if args.follow:
+                show(report, symbolize, args.sort)
+            last = report
+        # keep the tail, a report may be split across reads
+        keep = buf.rfind(MAGIC)
+        buf = buf[keep:] if keep >= 0 else buf[-(len(MAGIC) - 1):]
+    if last is None:
+        sys.exit("no report found")
+    if not args.follow:
+        show(last, symbolize, args.sort)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,440 @@
+#include "HeapProfiler.h"
+#include "mbed.h"
+#include "platform/mbed_mem_trace.h"
+#include "rtx_os.h"
+#include <new>
+#include <stdarg.h>
+
+#define SITE_EMPTY 0xFF
+
+typedef struct {
+  uint32_t caller;
+  uint8_t region;
+  uint32_t allocs;
+  uint32_t frees;
+  uint32_t failures;
+  uint32_t bytes;
+  uint32_t live_bytes;
+  uint32_t peak_bytes;
+  uint32_t max_size;
+  uint32_t lifetime[HEAP_PROFILER_LIFETIME_BUCKETS];
+} site_t;
+
+typedef struct {
+  uintptr_t ptr;
+  uint32_t size;
+  uint32_t time;
+  uint16_t site;
+} live_t;
+
+// Everything below is only touched with the mbed trace lock held, which
+// the malloc wrappers take before calling trace_cb()
+static site_t site_table[HEAP_PROFILER_SITES];
+static live_t live_table[HEAP_PROFILER_LIVE];
+static size_t site_count;
+static uint32_t live_bytes;
+static uint32_t peak_bytes;
+static uint32_t untracked_frees;
+static uint32_t dropped_sites;
+static uint32_t dropped_live;
+
+// Return addresses inside operator new, learnt by begin(). Allocations
+// coming from there are charged to the code that called new instead
+static uint32_t new_callers[3];
+static int calibrating = -1;
+static osThreadId_t calibrating_thread;
+
+// Where return addresses can point, the vector table and code in flash
+#ifdef MBED_ROM_START
+#define CODE_START MBED_ROM_START
+#else
+#define CODE_START 0
+#endif
+extern uint32_t __etext;
+
+static uint32_t hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x45d9f3b;
+  x ^= x >> 16;
+  return x;
+}
+
+static int lifetime_bucket(uint32_t ms) {
+  if (ms == 0) {
+    return 0;
+  }
+  int bucket = (31 - __builtin_clz(ms)) / 3 + 1;
+  return bucket < HEAP_PROFILER_LIFETIME_BUCKETS ? bucket : HEAP_PROFILER_LIFETIME_BUCKETS - 1;
+}
+
+// operator new pushed its own return address before calling malloc, so the
+// first code address on the stack above the one that returns into it is
+// where new was called from
+static uint32_t caller_of_new(uint32_t addr) {
+  if (core_util_is_isr_active()) {
+    return addr;
+  }
+  osRtxThread_t* thread = (osRtxThread_t*)osThreadGetId();
+  if (thread == NULL || thread->stack_mem == NULL) {
+    return addr;
+  }
+  uint32_t code_start = CODE_START;
+  uint32_t code_end = (uint32_t)&__etext;
+  uint32_t* sp = (uint32_t*)__get_PSP();
+  uint32_t* top = (uint32_t*)((uint8_t*)thread->stack_mem + thread->stack_size);
+  uint32_t* end = sp + HEAP_PROFILER_SCAN_DEPTH < top ? sp + HEAP_PROFILER_SCAN_DEPTH : top;
+  bool found = false;
+  for (; sp < end; sp++) {
+    uint32_t word = *sp;
+    if (!found) {
+      found = (word | 1) == addr;
+    } else if ((word & 1) && word >= code_start && word < code_end) {
+      return word;
+    }
+  }
+  return addr;
+}
+
+static uint32_t resolve_caller(void* caller) {
+  uint32_t addr = (uint32_t)caller | 1;
+  for (size_t i = 0; i < sizeof(new_callers) / sizeof(new_callers[0]); i++) {
+    if (new_callers[i] != 0 && addr == new_callers[i]) {
+      addr = caller_of_new(addr);
+      break;
+    }
+  }
+  return addr & ~1UL;
+}
+
+static site_t* find_site(uint32_t caller) {
+  uint32_t idx = hash(caller);
+  for (int i = 0; i < HEAP_PROFILER_SITES; i++, idx++) {
+    site_t* site = &site_table[idx & (HEAP_PROFILER_SITES - 1)];
+    if (site->region == SITE_EMPTY) {
+      memset(site, 0, sizeof(site_t));
+      site->caller = caller;
+      site_count++;
+      return site;
+    }
+    if (site->caller == caller) {
+      return site;
+    }
+  }
+  dropped_sites++;
+  return NULL;
+}
+
+static void live_insert(void* ptr, uint32_t size, site_t* site) {
+  uint32_t idx = hash((uintptr_t)ptr);
+  for (int i = 0; i < HEAP_PROFILER_LIVE; i++, idx++) {
+    live_t* entry = &live_table[idx & (HEAP_PROFILER_LIVE - 1)];
+    if (entry->ptr == 0) {
+      entry->ptr = (uintptr_t)ptr;
+      entry->size = size;
+      entry->time = millis();
+      entry->site = site - site_table;
+      return;
+    }
+  }
+  dropped_live++;
+}
+
+// Takes ptr out of the live table, shifting the entries after it back so
+// that linear probing still finds them
+static bool live_remove(void* ptr, live_t* out) {
+  uint32_t idx = hash((uintptr_t)ptr) & (HEAP_PROFILER_LIVE - 1);
+  for (int i = 0; i < HEAP_PROFILER_LIVE; i++, idx = (idx + 1) & (HEAP_PROFILER_LIVE - 1)) {
+    if (live_table[idx].ptr == 0) {
+      return false;
+    }
+    if (live_table[idx].ptr != (uintptr_t)ptr) {
+      continue;
+    }
+    *out = live_table[idx];
+    uint32_t hole = idx;
+    for (uint32_t next = (hole + 1) & (HEAP_PROFILER_LIVE - 1); live_table[next].ptr != 0; next = (next + 1) & (HEAP_PROFILER_LIVE - 1)) {
+      uint32_t home = hash(live_table[next].ptr) & (HEAP_PROFILER_LIVE - 1);
+      // move it unless its home lies cyclically in (hole, next]
+      if (((next - home) & (HEAP_PROFILER_LIVE - 1)) >= ((next - hole) & (HEAP_PROFILER_LIVE - 1))) {
+        live_table[hole] = live_table[next];
+        hole = next;
+      }
+    }
+    live_table[hole].ptr = 0;
+    return true;
+  }
+  return false;
+}
+
+static void on_alloc(void* res, size_t size, void* caller) {
+  site_t* site = find_site(resolve_caller(caller));
+  if (site == NULL) {
+    return;
+  }
+  if (res == NULL) {
+    site->failures++;
+    return;
+  }
+  site->region = (uintptr_t)res >> 28;
+  site->allocs++;
+  site->bytes += size;
+  site->live_bytes += size;
+  if (site->live_bytes > site->peak_bytes) {
+    site->peak_bytes = site->live_bytes;
+  }
+  if (size > site->max_size) {
+    site->max_size = size;
+  }
+  live_bytes += size;
+  if (live_bytes > peak_bytes) {
+    peak_bytes = live_bytes;
+  }
+  live_insert(res, size, site);
+}
+
+static void on_free(void* ptr) {
+  live_t entry;
+  if (ptr == NULL) {
+    return;
+  }
+  if (!live_remove(ptr, &entry)) {
+    untracked_frees++;
+    return;
+  }
+  site_t* site = &site_table[entry.site];
+  site->frees++;
+  site->live_bytes -= entry.size;
+  site->lifetime[lifetime_bucket(millis() - entry.time)]++;
+  live_bytes -= entry.size;
+}
+
+static void trace_cb(uint8_t op, void* res, void* caller, ...) {
+  va_list args;
+  va_start(args, caller);
+  if (calibrating >= 0 && osThreadGetId() == calibrating_thread) {
+    if (op == MBED_MEM_TRACE_MALLOC) {
+      new_callers[calibrating] = (uint32_t)caller | 1;
+    }
+    va_end(args);
+    return;
+  }
+  switch (op) {
+    case MBED_MEM_TRACE_MALLOC: {
+      size_t size = va_arg(args, size_t);
+      on_alloc(res, size, caller);
+      break;
+    }
+    case MBED_MEM_TRACE_CALLOC: {
+      size_t num = va_arg(args, size_t);
+      size_t size = va_arg(args, size_t);
+      on_alloc(res, num * size, caller);
+      break;
+    }
+    case MBED_MEM_TRACE_REALLOC: {
+      void* ptr = va_arg(args, void*);
+      size_t size = va_arg(args, size_t);
+      // a failed realloc leaves the old block alone, a zero sized one frees it
+      if (res != NULL || size == 0) {
+        on_free(ptr);
+      }
+      if (size != 0) {
+        on_alloc(res, size, caller);
+      }
+      break;
+    }
+    case MBED_MEM_TRACE_FREE: {
+      void* ptr = va_arg(args, void*);
+      on_free(ptr);
+      break;
+    }
+  }
+  va_end(args);
+}
+
+static void clear() {
+  for (int i = 0; i < HEAP_PROFILER_SITES; i++) {
+    site_table[i].region = SITE_EMPTY;
+  }
+  memset(live_table, 0, sizeof(live_table));
+  site_count = 0;
+  live_bytes = 0;
+  peak_bytes = 0;
+  untracked_frees = 0;
+  dropped_sites = 0;
+  dropped_live = 0;
+}
+
+// Zero filled is not empty, the table is marked before anything reports it
+static struct SiteTableInit {
+  SiteTableInit() {
+    clear();
+  }
+} site_table_init;
+
+// Nothing to lock when the wrappers do not trace
+static void trace_lock() {
+#if MBED_MEM_TRACING_ENABLED
+  mbed_mem_trace_lock();
+#endif
+}
+
+static void trace_unlock() {
+#if MBED_MEM_TRACING_ENABLED
+  mbed_mem_trace_unlock();
+#endif
+}
+
+void arduino::HeapProfilerClass::begin() {
+#if MBED_MEM_TRACING_ENABLED
+  // trace_cb() is what learns the callers of new, so it has to be in place
+  // for the calibration; what other threads allocate meanwhile is cleared
+  static void* volatile sink;
+  calibrating_thread = osThreadGetId();
+  calibrating = 0;
+  mbed_mem_trace_set_callback(trace_cb);
+  sink = ::operator new(1);
+  ::operator delete(sink);
+  calibrating = 1;
+  sink = ::operator new[](1);
+  ::operator delete[](sink);
+  calibrating = 2;
+  sink = ::operator new(1, std::nothrow);
+  ::operator delete(sink);
+  calibrating = -1;
+
+  trace_lock();
+  clear();
+  trace_unlock();
+#endif
+}
+
+void arduino::HeapProfilerClass::end() {
+#if MBED_MEM_TRACING_ENABLED
+  mbed_mem_trace_set_callback(NULL);
+#endif
+}
+
+void arduino::HeapProfilerClass::reset() {
+  trace_lock();
+  clear();
+  trace_unlock();
+}
+
+size_t arduino::HeapProfilerClass::sites() {
+  return site_count;
+}
+
+namespace {
+
+// Serialises little endian fields and keeps the running checksum
+class ReportWriter {
+public:
+  ReportWriter(Print& out)
+    : _out(out), _len(0), _sum1(0), _sum2(0), _total(0) {}
+
+  void u8(uint8_t v) {
+    _buf[_len++] = v;
+    _sum1 = (_sum1 + v) % 255;
+    _sum2 = (_sum2 + _sum1) % 255;
+    if (_len == sizeof(_buf)) {
+      flush();
+    }
+  }
+
+  void u16(uint16_t v) {
+    u8(v);
+    u8(v >> 8);
+  }
+
+  void u32(uint32_t v) {
+    u16(v);
+    u16(v >> 16);
+  }
+
+  void raw(const char* s, size_t len) {
+    flush();
+    _total += _out.write((const uint8_t*)s, len);
+  }
+
+  size_t finish() {
+    uint16_t checksum = (_sum2 << 8) | _sum1;
+    uint8_t tail[2] = { (uint8_t)checksum, (uint8_t)(checksum >> 8) };
+    flush();
+    _total += _out.write(tail, sizeof(tail));
+    return _total;
+  }
+
+private:
+  void flush() {
+    if (_len) {
+      _total += _out.write(_buf, _len);
+      _len = 0;
+    }
+  }
+
+  Print& _out;
+  uint8_t _buf[64];
+  size_t _len;
+  uint16_t _sum1;
+  uint16_t _sum2;
+  size_t _total;
+};
+
+
+static void write_site(ReportWriter& writer, const site_t& site) {
+  writer.u32(site.caller);
+  writer.u8(site.region);
+  writer.u32(site.allocs);
+  writer.u32(site.frees);
+  writer.u32(site.failures);
+  writer.u32(site.bytes);
+  writer.u32(site.live_bytes);
+  writer.u32(site.peak_bytes);
+  writer.u32(site.max_size);
+  for (int b = 0; b < HEAP_PROFILER_LIFETIME_BUCKETS; b++) {
+    writer.u32(site.lifetime[b]);
+  }
+}
+
+}
+
+size_t arduino::HeapProfilerClass::report(Print& out) {
+  ReportWriter writer(out);
+
+  // copy under the lock and print without it, writing to a port may need
+  // threads that allocate
+  trace_lock();
+  uint16_t count = site_count;
+  uint32_t header[5] = { live_bytes, peak_bytes, untracked_frees, dropped_sites, dropped_live };
+  trace_unlock();
+
+  writer.raw(HEAP_PROFILER_MAGIC, 4);
+  writer.u8(HEAP_PROFILER_VERSION);
+  writer.u16(count);
+  writer.u32(millis());
+  for (int i = 0; i < 5; i++) {
+    writer.u32(header[i]);
+  }
+
+  // sites are never removed, so the first count used slots all exist
+  uint16_t written = 0;
+  for (int i = 0; i < HEAP_PROFILER_SITES && written < count; i++) {
+    site_t site;
+    trace_lock();
+    site = site_table[i];
+    trace_unlock();
+    if (site.region != SITE_EMPTY) {
+      write_site(writer, site);
+      written++;
+    }
+  }
+  // a reset() meanwhile can leave fewer, pad so the frame stays well formed
+  site_t empty = {};
+  empty.region = SITE_EMPTY;
+  for (; written < count; written++) {
+    write_site(writer, empty);
+  }
+  return writer.finish();
+}
+
+arduino::HeapProfilerClass HeapProfiler;
@@ -0,0 +1,88 @@
+/*
+  HeapProfiler.h - per call site heap allocation statistics
+  Copyright (c) 2021 Arduino SA.  All right reserved.
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+#include "Arduino.h"
+
+// Distinct call sites that are tracked, a power of two
+#ifndef HEAP_PROFILER_SITES
+#define HEAP_PROFILER_SITES 64
+#endif
+
+// Live allocations whose size and age are remembered until they are freed,
+// a power of two
+#ifndef HEAP_PROFILER_LIVE
+#define HEAP_PROFILER_LIVE 512
+#endif
+
+// Stack words searched for the code that called operator new
+#ifndef HEAP_PROFILER_SCAN_DEPTH
+#define HEAP_PROFILER_SCAN_DEPTH 32
+#endif
+
+// Lifetime histogram: bucket 0 is under 1 ms, bucket k covers
+// [8^(k-1), 8^k) ms and the last one everything longer
+#define HEAP_PROFILER_LIFETIME_BUCKETS 8
+
+#define HEAP_PROFILER_MAGIC "HPRF"
+#define HEAP_PROFILER_VERSION 1
+
+namespace arduino {
+
+/*
+  Hooks into the mbed memory tracer, so it sees malloc, calloc, realloc,
+  free, new and delete on the system heap as well as SDRAM.malloc/free. For
+  each call site it keeps the number of allocations, frees and failures,
+  the bytes asked for, the bytes still live and their peak, the largest
+  request and how long the freed blocks lived.
+
+  Nothing is allocated by the profiler itself; when its tables are full the
+  extra sites and allocations are only counted as dropped.
+*/
+class HeapProfilerClass {
+
+public:
+  // Call early in setup(), before other threads allocate
+  void begin();
+  void end();
+
+  // Forgets all statistics, allocations made before are then seen as
+  // untracked when freed
+  void reset();
+
+  // Writes one binary report to out (Serial, SerialRPC, a File...) and
+  // returns its size. Layout, all little endian:
+  //   "HPRF" version:u8 sites:u16 uptime_ms:u32 live_bytes:u32
+  //   peak_bytes:u32 untracked_frees:u32 dropped_sites:u32 dropped_live:u32
+  //   sites x { caller:u32 region:u8 allocs:u32 frees:u32 failures:u32
+  //             bytes:u32 live_bytes:u32 peak_bytes:u32 max_size:u32
+  //             lifetime:u32[HEAP_PROFILER_LIFETIME_BUCKETS] }
+  //   fletcher16:u16 over everything after the magic
+  // region is the top nibble of the last block's address, which tells the
+  // internal RAM heaps from SDRAM
+  size_t report(Print& out);
+
+  // Call sites seen so far
+  size_t sites();
+};
+
+}
+
+extern arduino::HeapProfilerClass HeapProfiler;
+
+#endif
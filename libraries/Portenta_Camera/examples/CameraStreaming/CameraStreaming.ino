@@ -0,0 +1,35 @@
+#include "camera.h"
+#include "SDRAM.h"
+
+#define FRAMES 3
+
+CameraClass cam;
+
+void setup() {
+  Serial.begin(921600);
+  SDRAM.begin();
+
+  // Init the cam QVGA, 30FPS
+  cam.begin(CAMERA_R320x240, 30);
+
+  // Frame buffers must be 32 byte aligned
+  uint8_t *buffers = (uint8_t*)SDRAM.malloc(FRAMES * cam.frameSize() + 32);
+  buffers = (uint8_t*)(((uint32_t)buffers + 31) & ~31);
+
+  // Keep capturing at the sensor's frame rate
+  cam.startStreaming(buffers, FRAMES);
+}
+
+void loop() {
+  // Wait until the receiver acknowledges
+  // that they are ready to receive new data
+  while(Serial.read() != 1){};
+
+  // Take the oldest captured frame, the sensor keeps
+  // filling the other buffers meanwhile
+  uint8_t *frame = cam.getFrame();
+  if (frame != NULL) {
+     Serial.write(frame, cam.frameSize());
+     cam.releaseFrame(frame);
+  }
+}
@@ -15,6 +15,37 @@ static const int CamRes[][2] = {
 static __IO uint32_t camera_frame_ready = 0;
 static md_callback_t user_md_callback = NULL;
 
+/* Streaming state, shared with the DMA interrupt: the two buffers the DMA
+   is filling, the ones free for it and the captured ones not yet taken */
+typedef struct {
+  uint8_t *frames[CAMERA_MAX_FRAMES];
+  uint32_t head;
+  uint32_t count;
+} frame_queue_t;
+
+static uint8_t *stream_target[2];
+static frame_queue_t stream_free;
+static frame_queue_t stream_ready;
+static __IO uint32_t stream_dropped = 0;
+static uint32_t stream_framesize = 0;
+static frame_callback_t user_frame_callback = NULL;
+
+static void frame_push(frame_queue_t *q, uint8_t *frame)
+{
+  q->frames[(q->head + q->count++) % CAMERA_MAX_FRAMES] = frame;
+}
+
+static uint8_t *frame_pop(frame_queue_t *q)
+{
+  if (q->count == 0) {
+    return NULL;
+  }
+  uint8_t *frame = q->frames[q->head];
+  q->head = (q->head + 1) % CAMERA_MAX_FRAMES;
+  q->count--;
+  return frame;
+}
+
 /* DCMI DMA Stream definitions */
 #define CAMERA_DCMI_DMAx_CLK_ENABLE         __HAL_RCC_DMA2_CLK_ENABLE
 #define CAMERA_DCMI_DMAx_STREAM             DMA2_Stream3
@@ -25,6 +56,8 @@ extern "C" {
 DCMI_HandleTypeDef  hdcmi_discovery;
 
 void BSP_CAMERA_PwrUp(void);
+void BSP_CAMERA_StreamFrameCallback(uint32_t target);
+void BSP_CAMERA_ErrorCallback(void);
 
 /**
   * @brief  Initializes the DCMI MSP.
@@ -235,6 +268,50 @@ void BSP_CAMERA_SnapshotStart(uint8_t *buff, uint32_t framesize)
   HAL_DCMI_Start_DMA(&hdcmi_discovery, DCMI_MODE_SNAPSHOT, (uint32_t)buff, framesize / 4);
 }
 
+static void DCMI_StreamM0Cplt(DMA_HandleTypeDef *hdma)
+{
+  BSP_CAMERA_StreamFrameCallback(0);
+}
+
+static void DCMI_StreamM1Cplt(DMA_HandleTypeDef *hdma)
+{
+  BSP_CAMERA_StreamFrameCallback(1);
+}
+
+static void DCMI_StreamError(DMA_HandleTypeDef *hdma)
+{
+  BSP_CAMERA_ErrorCallback();
+}
+
+/**
+  * @brief  Starts the camera capture in continuous mode, the DMA alternates
+  *         between two buffers and every frame ends one transfer.
+  * @param  buff0: first frame buffer
+  * @param  buff1: second frame buffer
+  * @retval Camera status
+  */
+uint8_t BSP_CAMERA_StreamStart(uint8_t *buff0, uint8_t *buff1, uint32_t framesize)
+{
+  DMA_HandleTypeDef *hdma = hdcmi_discovery.DMA_Handle;
+
+  hdma->XferCpltCallback   = DCMI_StreamM0Cplt;
+  hdma->XferM1CpltCallback = DCMI_StreamM1Cplt;
+  hdma->XferErrorCallback  = DCMI_StreamError;
+  if (HAL_DMAEx_MultiBufferStart_IT(hdma, (uint32_t)&hdcmi_discovery.Instance->DR,
+                                    (uint32_t)buff0, (uint32_t)buff1, framesize / 4) != HAL_OK) {
+    return 1;
+  }
+
+  /* The transfers mark the frames, the DCMI frame interrupt is not needed */
+  __HAL_DCMI_DISABLE_IT(&hdcmi_discovery, DCMI_IT_FRAME);
+  hdcmi_discovery.State = HAL_DCMI_STATE_BUSY;
+  __HAL_DCMI_ENABLE(&hdcmi_discovery);
+  hdcmi_discovery.Instance->CR &= ~(DCMI_CR_CM);
+  hdcmi_discovery.Instance->CR |= DCMI_MODE_CONTINUOUS | DCMI_CR_CAPTURE;
+
+  return 0;
+}
+
 /**
   * @brief Suspend the CAMERA capture 
   * @retval None
@@ -384,6 +461,32 @@ void BSP_CAMERA_FrameEventCallback(void)
   camera_frame_ready++;
 }
 
+/**
+  * @brief  A streamed frame is complete in the buffer of DMA memory target,
+  *         which the DMA fills again after the other one. Gives it a free
+  *         buffer instead, or the oldest queued frame when there is none.
+  * @retval None
+  */
+void BSP_CAMERA_StreamFrameCallback(uint32_t target)
+{
+  uint8_t *next = frame_pop(&stream_free);
+  if (next == NULL) {
+    next = frame_pop(&stream_ready);
+    if (next == NULL) {
+      /* All the others are with the application, this frame is overwritten */
+      stream_dropped++;
+      return;
+    }
+    stream_dropped++;
+  }
+  HAL_DMAEx_ChangeMemory(hdcmi_discovery.DMA_Handle, (uint32_t)next, target ? MEMORY1 : MEMORY0);
+  frame_push(&stream_ready, stream_target[target]);
+  stream_target[target] = next;
+  if (user_frame_callback) {
+    user_frame_callback();
+  }
+}
+
 void DMA2_Stream3_IRQHandler(void)
 {
   HAL_DMA_IRQHandler(hdcmi_discovery.DMA_Handle);
@@ -500,7 +603,7 @@ int CameraClass::framerate(uint32_t framerate)
 
 int CameraClass::grab(uint8_t *buffer, uint32_t timeout)
 {
-  if (this->initialized == false) {
+  if (this->initialized == false || this->streaming) {
     return -1;
   }
 
@@ -533,6 +636,104 @@ int CameraClass::grab(uint8_t *buffer, uint32_t timeout)
   return 0;
 }
 
+uint32_t CameraClass::frameSize()
+{
+  if (this->initialized == false) {
+    return 0;
+  }
+  return CamRes[this->resolution][0] * CamRes[this->resolution][1];
+}
+
+int CameraClass::startStreaming(uint8_t *buffers, uint32_t count, frame_callback_t callback)
+{
+  if (this->initialized == false || this->streaming) {
+    return -1;
+  }
+
+  /* Two for the DMA and at least one the application can hold */
+  if (count < 3 || count > CAMERA_MAX_FRAMES || ((uint32_t)buffers & 31) != 0) {
+    return -1;
+  }
+
+  uint32_t framesize = frameSize();
+
+  /* No stale lines may be written back over what the DMA stores */
+  SCB_InvalidateDCache_by_Addr((uint32_t*)buffers, framesize * count);
+
+  stream_framesize = framesize;
+  stream_dropped = 0;
+  stream_free.head = stream_free.count = 0;
+  stream_ready.head = stream_ready.count = 0;
+  stream_target[0] = buffers;
+  stream_target[1] = buffers + framesize;
+  for (uint32_t i = 2; i < count; i++) {
+    frame_push(&stream_free, buffers + i * framesize);
+  }
+  user_frame_callback = callback;
+
+  /* A grab() leaves the capture suspended, streaming restarts it */
+  if (BSP_CAMERA_StreamStart(stream_target[0], stream_target[1], framesize) != 0) {
+    return -1;
+  }
+
+  this->streaming = true;
+  return 0;
+}
+
+int CameraClass::stopStreaming()
+{
+  if (this->streaming == false) {
+    return -1;
+  }
+
+  BSP_CAMERA_Stop();
+  user_frame_callback = NULL;
+  this->streaming = false;
+  return 0;
+}
+
+uint8_t *CameraClass::getFrame(uint32_t timeout)
+{
+  if (this->streaming == false) {
+    return NULL;
+  }
+
+  for (uint32_t start = millis();;) {
+    core_util_critical_section_enter();
+    uint8_t *frame = frame_pop(&stream_ready);
+    core_util_critical_section_exit();
+
+    if (frame != NULL) {
+      /* Invalidate buffer after DMA transfer */
+      SCB_InvalidateDCache_by_Addr((uint32_t*)frame, stream_framesize);
+      return frame;
+    }
+    if ((millis() - start) >= timeout) {
+      return NULL;
+    }
+    __WFI();
+  }
+}
+
+void CameraClass::releaseFrame(uint8_t *frame)
+{
+  if (this->streaming == false || frame == NULL) {
+    return;
+  }
+
+  /* Drop whatever the application left in the cache before the DMA reuses it */
+  SCB_InvalidateDCache_by_Addr((uint32_t*)frame, stream_framesize);
+
+  core_util_critical_section_enter();
+  frame_push(&stream_free, frame);
+  core_util_critical_section_exit();
+}
+
+uint32_t CameraClass::droppedFrames()
+{
+  return stream_dropped;
+}
+
 int CameraClass::standby(bool enable)
 {
   if (this->initialized == false) {
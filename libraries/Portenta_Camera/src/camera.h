@@ -8,18 +8,38 @@ enum {
 };
 
 typedef void (*md_callback_t)();
+typedef void (*frame_callback_t)();
+
+/* Most frame buffers startStreaming() accepts */
+#ifndef CAMERA_MAX_FRAMES
+#define CAMERA_MAX_FRAMES 8
+#endif
 
 class CameraClass {
     private:
         uint32_t resolution;
         bool     initialized;
+        bool     streaming;
         mbed::InterruptIn md_irq;
         void HIMAXIrqHandler();
     public:
-        CameraClass(): initialized(false), md_irq(PC_15){}
+        CameraClass(): initialized(false), streaming(false), md_irq(PC_15){}
         int begin(uint32_t resolution = CAMERA_R320x240, uint32_t framerate = 30);
         int framerate(uint32_t framerate);
         int grab(uint8_t *buffer, uint32_t timeout=5000);
+        uint32_t frameSize();
+        /* Continuous capture into count frame buffers of frameSize() bytes,
+           back to back from buffers and 32 byte aligned. The DMA always fills
+           two of them; the callback runs from interrupt context whenever a
+           frame is queued. When the application keeps up no frame is lost,
+           otherwise the oldest queued frame is given up for the new one */
+        int startStreaming(uint8_t *buffers, uint32_t count, frame_callback_t callback=NULL);
+        int stopStreaming();
+        /* Oldest captured frame, owned by the caller until releaseFrame(),
+           or NULL after timeout ms */
+        uint8_t *getFrame(uint32_t timeout=5000);
+        void releaseFrame(uint8_t *frame);
+        uint32_t droppedFrames();
         int standby(bool enable);
         int motionDetection(bool enable, md_callback_t callback=NULL);
         int motionDetectionWindow(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
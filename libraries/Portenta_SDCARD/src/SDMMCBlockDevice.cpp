@@ -30,6 +30,7 @@
 #define SD_DBG 0 /*!< 1 - Enable debugging */
 
 using namespace mbed;
+using namespace std::chrono_literals;
 
 /** Enum of standard error codes
  *
@@ -54,10 +55,48 @@ enum bd_sd_error {
 
 #define BLOCK_SIZE_HC 512 /*!< Block size supported for SD card is 512 bytes  */
 
+/* End of the DMA transfer in flight, signalled from the SDMMC2 interrupt */
+static rtos::Semaphore xfer_done(0, 1);
+static volatile bool xfer_busy = false;
+static volatile bool xfer_failed = false;
+
+extern "C" void BSP_SD_ReadCpltCallback(void)
+{
+    xfer_busy = false;
+    xfer_done.release();
+}
+
+extern "C" void BSP_SD_WriteCpltCallback(void)
+{
+    xfer_busy = false;
+    xfer_done.release();
+}
+
+extern "C" void BSP_SD_ErrorCallback(void)
+{
+    xfer_failed = true;
+    xfer_busy = false;
+    xfer_done.release();
+}
+
+/* The SDMMC2 DMA reaches the AXI, D2 and D3 SRAMs and the SDRAM but not the TCMs,
+ * and needs words. Reads are invalidated in the D-cache afterwards, so they must
+ * own the cache lines they touch */
+static bool dma_capable(const void *buffer, bd_size_t size, bool is_read)
+{
+#if SDMMC_BLOCKDEVICE_DMA
+    uint32_t addr = (uint32_t)buffer;
+    uint32_t align = is_read ? __SCB_DCACHE_LINE_SIZE : 4;
+    return addr >= 0x24000000 && (addr % align) == 0 && (size % align) == 0;
+#else
+    return false;
+#endif
+}
+
 SDMMCBlockDevice::SDMMCBlockDevice() :
     _read_size (BLOCK_SIZE_HC), _program_size (BLOCK_SIZE_HC),
     _erase_size(BLOCK_SIZE_HC), _block_size (BLOCK_SIZE_HC),
-    _capacity_in_blocks (0)
+    _capacity_in_blocks (0), _pending (false), _async_status (SD_BLOCK_DEVICE_OK)
 {
     _timeout = 1000;
 }
@@ -112,6 +151,7 @@ int SDMMCBlockDevice::init()
 int SDMMCBlockDevice::deinit()
 {
     lock();
+    finish();
     _sd_state = BSP_SD_DeInit ();
     if(_sd_state != MSD_OK) {
         debug_if (SD_DBG, "SD card deinitialization failed\n");
@@ -134,32 +174,51 @@ int SDMMCBlockDevice::read(void *b, bd_addr_t addr, bd_size_t size)
         return SD_BLOCK_DEVICE_ERROR_NO_INIT;
     }
 
-    uint32_t *buffer = static_cast<uint32_t *> (b);
-    int status = SD_BLOCK_DEVICE_OK;
+    start(b, addr, size, true, false);
+    int status = finish();
 
-    // Get block address
-    uint32_t block_addr = addr / _block_size;
-    // Get block count
-    uint32_t block_cnt = size / _block_size;
+    unlock ();
+    return status;
+}
 
-    debug_if(
-        SD_DBG,
-        "SDMMCBlockDevice::read addr: 0x%x, block_addr: %i size: %lu block count: %i\n",
-        addr, block_addr, size, block_cnt);
+int SDMMCBlockDevice::program(const void *b, bd_addr_t addr, bd_size_t size)
+{
+    if(!is_valid_program (addr, size)) {
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
+    }
 
-    if(BSP_SD_ReadBlocks (buffer, block_addr, block_cnt, _timeout) != MSD_OK) {
-        status = SD_BLOCK_DEVICE_ERROR_READ;
+    lock();
+    if(!_is_initialized) {
+        unlock ();
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;
     }
 
-    // Wait until SD card is ready to use for new operation
-    while(BSP_SD_GetCardState() != SD_TRANSFER_OK) {
+    start(const_cast<void *>(b), addr, size, false, false);
+    int status = finish();
+
+    unlock();
+    return status;
+}
+
+int SDMMCBlockDevice::read_async(void *b, bd_addr_t addr, bd_size_t size)
+{
+    if(!is_valid_read (addr, size)) {
+        return SD_BLOCK_DEVICE_ERROR_PARAMETER;
     }
 
-    unlock ();
+    lock();
+    if(!_is_initialized) {
+        unlock();
+        return SD_BLOCK_DEVICE_ERROR_NO_INIT;
+    }
+
+    int status = start(b, addr, size, true, true);
+
+    unlock();
     return status;
 }
 
-int SDMMCBlockDevice::program(const void *b, bd_addr_t addr, bd_size_t size)
+int SDMMCBlockDevice::program_async(const void *b, bd_addr_t addr, bd_size_t size)
 {
     if(!is_valid_program (addr, size)) {
         return SD_BLOCK_DEVICE_ERROR_PARAMETER;
@@ -167,33 +226,119 @@ int SDMMCBlockDevice::program(const void *b, bd_addr_t addr, bd_size_t size)
 
     lock();
     if(!_is_initialized) {
-        unlock ();
+        unlock();
         return SD_BLOCK_DEVICE_ERROR_NO_INIT;
     }
 
-    uint32_t* buffer =
-        const_cast<uint32_t*> (reinterpret_cast<const uint32_t*> (b));
-    int status = SD_BLOCK_DEVICE_OK;
+    int status = start(const_cast<void *>(b), addr, size, false, true);
+
+    unlock();
+    return status;
+}
+
+int SDMMCBlockDevice::wait()
+{
+    lock();
+    finish();
+    int status = _async_status;
+    _async_status = SD_BLOCK_DEVICE_OK;
+    unlock();
+    return status;
+}
+
+bool SDMMCBlockDevice::busy() const
+{
+    return _pending && _pending_dma && xfer_busy;
+}
+
+/* Starts a transfer, once the one before it has finished; called with the lock held */
+int SDMMCBlockDevice::start(void *b, bd_addr_t addr, bd_size_t size, bool is_read, bool is_async)
+{
+    finish();
+
+    uint32_t *buffer = static_cast<uint32_t *> (b);
+    int error = is_read ? SD_BLOCK_DEVICE_ERROR_READ : SD_BLOCK_DEVICE_ERROR_PROGRAM;
+    uint8_t ret;
 
     // Get block address
     uint32_t block_addr = addr / _block_size;
     // Get block count
     uint32_t block_cnt = size / _block_size;
 
-    debug_if (
+    debug_if(
         SD_DBG,
-        "SDMMCBlockDevice::program addr: 0x%x, block_addr: %i size: %lu block count: %i\n",
-        addr, block_addr, size, block_cnt);
+        "SDMMCBlockDevice::%s addr: 0x%x, block_addr: %i size: %lu block count: %i\n",
+        is_read ? "read" : "program", addr, block_addr, size, block_cnt);
+
+    _pending_dma = dma_capable(b, size, is_read);
+    if(_pending_dma) {
+        // The DMA bypasses the D-cache: written data must be in memory, and no dirty
+        // line may be evicted over data being read
+        if(is_read) {
+            SCB_InvalidateDCache_by_Addr(buffer, size);
+        } else {
+            SCB_CleanDCache_by_Addr(buffer, size);
+        }
+        xfer_done.try_acquire();
+        xfer_failed = false;
+        xfer_busy = true;
+        ret = is_read ? BSP_SD_ReadBlocks_DMA (buffer, block_addr, block_cnt)
+                      : BSP_SD_WriteBlocks_DMA (buffer, block_addr, block_cnt);
+        if(ret != MSD_OK) {
+            xfer_busy = false;
+            _pending_dma = false;
+        }
+    } else {
+        ret = is_read ? BSP_SD_ReadBlocks (buffer, block_addr, block_cnt, _timeout)
+                      : BSP_SD_WriteBlocks (buffer, block_addr, block_cnt, _timeout);
+    }
+
+    // Even a failed transfer leaves the card to return to transfer state
+    _pending = true;
+    _pending_read = is_read;
+    _pending_async = is_async && ret == MSD_OK;
+    _pending_buffer = b;
+    _pending_size = size;
+    _pending_status = (ret == MSD_OK) ? SD_BLOCK_DEVICE_OK : error;
+    return _pending_status;
+}
 
-    if(BSP_SD_WriteBlocks (buffer, block_addr, block_cnt, _timeout) != MSD_OK) {
-        status = SD_BLOCK_DEVICE_ERROR_PROGRAM;
+/* Waits for the transfer in flight, if any, and returns how it went; called with the lock held */
+int SDMMCBlockDevice::finish()
+{
+    if(!_pending) {
+        return SD_BLOCK_DEVICE_OK;
     }
 
-    // Wait until SD card is ready to use for new operation
+    int status = _pending_status;
+    int error = _pending_read ? SD_BLOCK_DEVICE_ERROR_READ : SD_BLOCK_DEVICE_ERROR_PROGRAM;
+
+    if(_pending_dma) {
+        // Sleep until the SDMMC interrupt reports the end of the transfer
+        if(!xfer_done.try_acquire_for(std::chrono::milliseconds(_timeout))) {
+            debug_if(SD_DBG, "SDMMCBlockDevice DMA transfer timed out\n");
+            BSP_SD_Abort();
+            xfer_busy = false;
+            status = error;
+        } else if(xfer_failed) {
+            status = error;
+        }
+        // Drop lines speculatively fetched while the DMA was writing
+        if(_pending_read) {
+            SCB_InvalidateDCache_by_Addr(_pending_buffer, _pending_size);
+        }
+    }
+
+    // Wait until SD card is ready to use for new operation, programming takes a
+    // while so sleep rather than spin
     while(BSP_SD_GetCardState() != SD_TRANSFER_OK) {
+        rtos::ThisThread::sleep_for(1ms);
     }
 
-    unlock();
+    _pending = false;
+    if(_pending_async && status != SD_BLOCK_DEVICE_OK && _async_status == SD_BLOCK_DEVICE_OK) {
+        _async_status = status;
+    }
     return status;
 }
 
@@ -208,6 +353,7 @@ int SDMMCBlockDevice::erase(bd_addr_t addr, bd_size_t size)
         unlock();
         return SD_BLOCK_DEVICE_ERROR_NO_INIT;
     }
+    finish();
 
     size -= _block_size;
 
@@ -260,4 +406,4 @@ bd_size_t SDMMCBlockDevice::size() const
 const char *SDMMCBlockDevice::get_type() const
 {
     return "SDCARD";
-}
\ No newline at end of file
+}
\ No newline at end of file
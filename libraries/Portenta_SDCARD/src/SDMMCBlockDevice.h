@@ -23,6 +23,12 @@
 #include "platform/PlatformMutex.h"
 #include "BSP.h"
 
+/* Transfers run on the SDMMC's own DMA while the calling thread sleeps; set to 0
+ * to always poll the FIFO instead */
+#ifndef SDMMC_BLOCKDEVICE_DMA
+#define SDMMC_BLOCKDEVICE_DMA 1
+#endif
+
 //using namespace mbed;
 
 /**
@@ -89,6 +95,20 @@
  * }
  * @endcode
  *
+ * Blocks can also be written while the next ones are being filled, e.g. by a logger
+ * with two buffers:
+ * @code
+ * uint32_t buffers[2][4096 / 4] __attribute__((aligned(32)));
+ * bd_addr_t addr = 0;
+ *
+ * for (int i = 0; ; i = !i) {
+ *   fill(buffers[i], sizeof(buffers[i]));
+ *   // waits for the other buffer, if still being written, before starting this one
+ *   bd.program_async(buffers[i], addr, sizeof(buffers[i]));
+ *   addr += sizeof(buffers[i]);
+ * }
+ * @endcode
+ *
  */
 class SDMMCBlockDevice : public mbed::BlockDevice
 {
@@ -144,6 +164,44 @@ public:
      */
     virtual int erase(mbed::bd_addr_t addr, mbed::bd_size_t size);
 
+    /** Start reading blocks and return without waiting for them
+     *
+     *  The buffer must be left alone until wait() returns or the next transfer starts.
+     *  Any transfer still in flight is waited for first. A buffer the DMA cannot use,
+     *  one in the TCMs or not aligned to a cache line, is read before this returns
+     *
+     *  @param buffer   Buffer to read blocks into
+     *  @param addr     Address of block to begin reading from
+     *  @param size     Size to read in bytes, must be a multiple of read block size
+     *  @return         0 if the read was started, negative error code on failure
+     */
+    int read_async(void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size);
+
+    /** Start programming blocks and return without waiting for them
+     *
+     *  The buffer must be left alone until wait() returns or the next transfer starts.
+     *  Any transfer still in flight is waited for first. A buffer the DMA cannot use,
+     *  one in the TCMs or not word aligned, is written before this returns
+     *
+     *  @param buffer   Buffer of data to write to blocks
+     *  @param addr     Address of block to begin writing to
+     *  @param size     Size to write in bytes, must be a multiple of program block size
+     *  @return         0 if the program was started, negative error code on failure
+     */
+    int program_async(const void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size);
+
+    /** Wait for the transfers started by read_async() and program_async()
+     *
+     *  @return         0 if all of them succeeded, otherwise the error of one that failed
+     */
+    int wait();
+
+    /** Check if a transfer started by read_async() or program_async() is still running
+     *
+     *  @return         true while the data is still moving
+     */
+    bool busy() const;
+
     /** Get the size of a readable block
      *
      *  @return         Size of a readable block in bytes
@@ -183,6 +241,20 @@ private:
     PlatformMutex _mutex;
     bool _is_initialized;
 
+    // transfer started and not finished yet
+    bool _pending;
+    bool _pending_dma;
+    bool _pending_read;
+    bool _pending_async;
+    void *_pending_buffer;
+    mbed::bd_size_t _pending_size;
+    int _pending_status;
+    // first error of an async transfer, until wait() reports it
+    int _async_status;
+
+    int start(void *buffer, mbed::bd_addr_t addr, mbed::bd_size_t size, bool is_read, bool is_async);
+    int finish();
+
     virtual void
     lock () {
         _mutex.lock();
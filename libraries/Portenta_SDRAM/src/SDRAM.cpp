@@ -1,8 +1,101 @@
 #include "SDRAM.h"
+#include "mbed.h"
+#include "platform/mbed_mem_trace.h"
 extern "C" {
 	#include "ram_internal.h"
 }
 
+// Small blocks come from per thread magazines that need no locking; the heap
+// behind them is shared and guarded by heap_mutex
+#define SDRAM_MAGAZINE_CLASSES		8
+#define SDRAM_MAGAZINE_MIN_SIZE		32
+
+typedef struct _magazine {
+	osThreadId_t owner;
+	uint8_t count[SDRAM_MAGAZINE_CLASSES];
+	void* blocks[SDRAM_MAGAZINE_CLASSES][SDRAM_MAGAZINE_DEPTH];
+} magazine_t;
+
+static rtos::Mutex heap_mutex;
+static magazine_t* magazines = NULL;
+// Blocks freed from interrupts, linked through their first word
+static void* volatile deferred_frees = NULL;
+
+// Index of the smallest class (32, 64, ... 4096 bytes) that holds size
+static int size_class(size_t size) {
+	if (size <= SDRAM_MAGAZINE_MIN_SIZE) {
+		return 0;
+	}
+	int cls = 32 - __builtin_clz(size - 1) - 5;
+	return cls < SDRAM_MAGAZINE_CLASSES ? cls : -1;
+}
+
+static size_t class_size(int cls) {
+	return (size_t)SDRAM_MAGAZINE_MIN_SIZE << cls;
+}
+
+static magazine_t* magazine(bool claim = true) {
+	if (magazines == NULL) {
+		return NULL;
+	}
+	osThreadId_t self = rtos::ThisThread::get_id();
+	for (int i = 0; i < SDRAM_MAGAZINE_THREADS; i++) {
+		if (magazines[i].owner == self) {
+			return &magazines[i];
+		}
+	}
+	for (int i = 0; claim && i < SDRAM_MAGAZINE_THREADS; i++) {
+		void* expected = NULL;
+		if (core_util_atomic_cas_ptr((void* volatile*)&magazines[i].owner, &expected, self)) {
+			return &magazines[i];
+		}
+	}
+	// all taken: one whose thread ended without flushCache() is taken over,
+	// blocks and all
+	for (int i = 0; claim && i < SDRAM_MAGAZINE_THREADS; i++) {
+		void* owner = magazines[i].owner;
+		osThreadState_t state = osThreadGetState((osThreadId_t)owner);
+		if ((state == osThreadTerminated || state == osThreadInactive || state == osThreadError) &&
+		    core_util_atomic_cas_ptr((void* volatile*)&magazines[i].owner, &owner, self)) {
+			return &magazines[i];
+		}
+	}
+	return NULL;
+}
+
+// Reports to the mbed memory tracer as well, so a heap profiler sees this
+// heap next to the system one. Not from interrupts, the tracer locks a mutex
+static void trace_malloc(void* ptr, size_t size, void* caller) {
+#if MBED_MEM_TRACING_ENABLED
+	mbed_mem_trace_lock();
+	mbed_mem_trace_malloc(ptr, size, caller);
+	mbed_mem_trace_unlock();
+#endif
+}
+
+static void trace_free(void* ptr, void* caller) {
+#if MBED_MEM_TRACING_ENABLED
+	mbed_mem_trace_lock();
+	mbed_mem_trace_free(ptr, caller);
+	mbed_mem_trace_unlock();
+#endif
+}
+
+static void heap_lock() {
+	heap_mutex.lock();
+	void* ptr = core_util_atomic_exchange_ptr(&deferred_frees, NULL);
+	while (ptr != NULL) {
+		void* next = *(void**)ptr;
+		trace_free(ptr, NULL);
+		ea_free(ptr);
+		ptr = next;
+	}
+}
+
+static void heap_unlock() {
+	heap_mutex.unlock();
+}
+
 int SDRAMClass::begin(uint32_t start_address) {
 
 	printf("FMC_SDRAM_DEVICE->SDCMR: %x\n", FMC_SDRAM_DEVICE->SDCMR);
@@ -63,18 +156,96 @@ int SDRAMClass::begin(uint32_t start_address) {
 
 	if (start_address) {
 		printf("malloc_addblock: allocate %d bytes\n", SDRAM_END_ADDRESS - start_address);
+		heap_lock();
 		malloc_addblock((void*)start_address, SDRAM_END_ADDRESS - start_address);
+		if (SDRAM_MAGAZINE_THREADS > 0 && magazines == NULL) {
+			magazine_t* table = (magazine_t*)ea_malloc(sizeof(magazine_t) * SDRAM_MAGAZINE_THREADS);
+			if (table != NULL) {
+				memset(table, 0, sizeof(magazine_t) * SDRAM_MAGAZINE_THREADS);
+				magazines = table;
+			}
+		}
+		heap_unlock();
 	}
 
 	return 1;
 }
 
+static void* heap_malloc(size_t size) {
+	int cls = size_class(size);
+	magazine_t* mag = cls >= 0 ? magazine() : NULL;
+	if (mag != NULL && mag->count[cls] > 0) {
+		return mag->blocks[cls][--mag->count[cls]];
+	}
+
+	void* ptr;
+	heap_lock();
+	if (mag != NULL) {
+		// refill half the magazine while the lock is held anyway
+		ptr = ea_malloc(class_size(cls));
+		while (ptr != NULL && mag->count[cls] < SDRAM_MAGAZINE_DEPTH / 2) {
+			void* extra = ea_malloc(class_size(cls));
+			if (extra == NULL) {
+				break;
+			}
+			mag->blocks[cls][mag->count[cls]++] = extra;
+		}
+	} else {
+		ptr = ea_malloc(size);
+	}
+	heap_unlock();
+	return ptr;
+}
+
 void* SDRAMClass::malloc(size_t size) {
-	return ea_malloc(size);
+	if (size == 0 || core_util_is_isr_active()) {
+		return NULL;
+	}
+	void* ptr = heap_malloc(size);
+	trace_malloc(ptr, size, MBED_CALLER_ADDR());
+	return ptr;
 }
 
 void SDRAMClass::free(void* ptr) {
+	if (ptr == NULL) {
+		return;
+	}
+	if (core_util_is_isr_active()) {
+		void* head = deferred_frees;
+		do {
+			*(void**)ptr = head;
+		} while (!core_util_atomic_cas_ptr(&deferred_frees, &head, ptr));
+		return;
+	}
+	trace_free(ptr, MBED_CALLER_ADDR());
+
+	// only blocks of exactly a class size go back to the magazine
+	size_t size = ea_malloc_usable_size(ptr);
+	int cls = size_class(size);
+	magazine_t* mag = (cls >= 0 && size == class_size(cls)) ? magazine() : NULL;
+	if (mag != NULL && mag->count[cls] < SDRAM_MAGAZINE_DEPTH) {
+		mag->blocks[cls][mag->count[cls]++] = ptr;
+		return;
+	}
+
+	heap_lock();
 	ea_free(ptr);
+	heap_unlock();
+}
+
+void SDRAMClass::flushCache() {
+	magazine_t* mag = magazine(false);
+	if (mag == NULL) {
+		return;
+	}
+	heap_lock();
+	for (int cls = 0; cls < SDRAM_MAGAZINE_CLASSES; cls++) {
+		while (mag->count[cls] > 0) {
+			ea_free(mag->blocks[cls][--mag->count[cls]]);
+		}
+	}
+	heap_unlock();
+	mag->owner = NULL;
 }
 
 bool __attribute__((optimize("O0"))) SDRAMClass::test(bool fast) {
@@ -7,12 +7,29 @@
 #define SDRAM_END_ADDRESS			(0x60800000)
 #define SDRAM_START_ADDRESS			(0x60000000)
 
+// Threads that get a cache of small blocks, the others always go through the
+// locked heap. 0 disables the caches
+#ifndef SDRAM_MAGAZINE_THREADS
+#define SDRAM_MAGAZINE_THREADS		4
+#endif
+// Blocks cached per thread for each size class
+#ifndef SDRAM_MAGAZINE_DEPTH
+#define SDRAM_MAGAZINE_DEPTH		8
+#endif
+
 class SDRAMClass {
 public:
 	SDRAMClass() {}
 	int begin(uint32_t start_address = SDRAM_START_ADDRESS);
+	// Safe to call from any thread. malloc() returns NULL from interrupts;
+	// free() works from them, the block is handed back by the next thread
+	// that uses the heap
 	void* malloc(size_t size);
 	void free(void* ptr);
+	// Returns the blocks cached for the calling thread, call it before the
+	// thread exits. Otherwise they stay cached until another thread finds
+	// no free cache and takes this one over
+	void flushCache();
 	bool test(bool fast = false);
 private:
 	void mpu_config_start(void) {
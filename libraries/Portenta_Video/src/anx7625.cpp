@@ -1203,8 +1203,17 @@ int stm32_dsi_config(uint8_t bus, struct edid *edid, struct display_timing *dt)
 	stm32_LCD_Clear(0);
 }
 
+/* The handle is shared with transfers started elsewhere in interrupt mode,
+   one may still be running when it is set up again */
+void stm32_DMA2D_Wait(void)
+{
+	while (dma2d.State == HAL_DMA2D_STATE_BUSY) {}
+}
+
 static void LL_FillBuffer(uint32_t LayerIndex, void *pDst, uint32_t xSize, uint32_t ySize, uint32_t OffLine, uint32_t ColorIndex)
 {
+	stm32_DMA2D_Wait();
+
 	/* Register to memory mode with ARGB8888 as color Mode */
 	dma2d.Init.Mode         = DMA2D_R2M;
 	dma2d.Init.ColorMode    = DMA2D_OUTPUT_RGB565;	//DMA2D_OUTPUT_ARGB8888
@@ -1246,6 +1255,8 @@ void stm32_LCD_FillArea(void *pDst, uint32_t xSize, uint32_t ySize, uint32_t Col
 
 void stm32_LCD_DrawImage(void *pSrc, void *pDst, uint32_t xSize, uint32_t ySize, uint32_t ColorMode)
 {
+	stm32_DMA2D_Wait();
+
 	/* Configure the DMA2D Mode, Color Mode and output offset */
 	dma2d.Init.Mode         = DMA2D_M2M_PFC;
 	dma2d.Init.ColorMode    = DMA2D_OUTPUT_RGB565;
@@ -385,5 +385,6 @@ uint32_t stm32_getXSize();
 uint32_t stm32_getYSize();
 uint32_t getFramebufferEnd();
 DMA2D_HandleTypeDef* stm32_get_DMA2D(void);
+void stm32_DMA2D_Wait(void);
 
 #endif  /* __ANX7625_H__ */
@@ -9,19 +9,37 @@
 static uint32_t lcd_x_size = 0;
 static uint32_t lcd_y_size = 0;
 
+/* Size of each of the two draw buffers in SDRAM, in pixels */
+#ifndef LVGL_DRAW_BUFFER_SIZE
+#define LVGL_DRAW_BUFFER_SIZE   (LV_HOR_RES_MAX * LV_VER_RES_MAX / 6)
+#endif
+
 static uint16_t * fb;
 static lv_disp_drv_t disp_drv;
 
-/* Display flushing */
+extern "C" void DMA2D_IRQHandler(void)
+{
+  HAL_DMA2D_IRQHandler(stm32_get_DMA2D());
+}
+
+static void dma2d_flush_done(DMA2D_HandleTypeDef * dma2d)
+{
+  lv_disp_flush_ready(&disp_drv); /* tell lvgl that flushing is done */
+}
+
+/* Display flushing, completes in the DMA2D interrupt while lvgl renders
+   into the other draw buffer */
 static void my_disp_flush(lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *color_p)
 {
 
 #if ARDUINO_PORTENTA_H7_M7
-  SCB_CleanInvalidateDCache();
-  SCB_InvalidateICache();
+  /* The DMA2D only reads the draw buffer */
+  SCB_CleanDCache();
 #endif
 
   DMA2D_HandleTypeDef * dma2d = stm32_get_DMA2D();
+  /* a flush may still be copying */
+  stm32_DMA2D_Wait();
 
   lv_color_t * pDst = (lv_color_t*)fb;
   pDst += area->y1 * lcd_x_size + area->x1;
@@ -36,7 +54,8 @@ static void my_disp_flush(lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t
   dma2d->Init.RedBlueSwap   = DMA2D_RB_REGULAR;     /* No Output Red & Blue swap */
 
   /*##-2- DMA2D Callbacks Configuration ######################################*/
-  dma2d->XferCpltCallback  = NULL;
+  dma2d->XferCpltCallback  = dma2d_flush_done;
+  dma2d->XferErrorCallback = dma2d_flush_done;
 
   /*##-3- Foreground Configuration ###########################################*/
   dma2d->LayerCfg[1].AlphaMode = DMA2D_NO_MODIF_ALPHA;
@@ -49,8 +68,9 @@ static void my_disp_flush(lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t
   /* DMA2D Initialization */
   if (HAL_DMA2D_Init(dma2d) == HAL_OK) {
     if (HAL_DMA2D_ConfigLayer(dma2d, 1) == HAL_OK) {
-      HAL_DMA2D_Start(dma2d, (uint32_t)color_p, (uint32_t)pDst, w, h);
-      HAL_DMA2D_PollForTransfer(dma2d, 1000);
+      if (HAL_DMA2D_Start_IT(dma2d, (uint32_t)color_p, (uint32_t)pDst, w, h) == HAL_OK) {
+        return;
+      }
     }
   }
 
@@ -68,6 +88,8 @@ static void gpu_blend(lv_disp_drv_t * disp_drv, lv_color_t * dest, const lv_colo
 #endif
 
   DMA2D_HandleTypeDef * dma2d = stm32_get_DMA2D();
+  /* a flush may still be copying */
+  stm32_DMA2D_Wait();
 
   dma2d->Instance = DMA2D;
   dma2d->Init.Mode = DMA2D_M2M_BLEND;
@@ -103,6 +125,8 @@ static void gpu_fill(lv_disp_drv_t * disp_drv, lv_color_t * dest_buf, lv_coord_t
 #endif
 
   DMA2D_HandleTypeDef * dma2d = stm32_get_DMA2D();
+  /* a flush may still be copying */
+  stm32_DMA2D_Wait();
 
   lv_color_t * destination = dest_buf + (dest_width * fill_area->y1 + fill_area->x1);
 
@@ -150,12 +174,18 @@ void portenta_init_video() {
   fb = (uint16_t *)getNextFrameBuffer();
   getNextFrameBuffer();
 
-  static lv_color_t buf[LV_HOR_RES_MAX * LV_VER_RES_MAX / 6];
+  // Two draw buffers, lvgl renders into one while the other is flushed
+  lv_color_t * buf1 = (lv_color_t *)SDRAM.malloc(LVGL_DRAW_BUFFER_SIZE * sizeof(lv_color_t));
+  lv_color_t * buf2 = (lv_color_t *)SDRAM.malloc(LVGL_DRAW_BUFFER_SIZE * sizeof(lv_color_t));
+  if (buf1 == NULL) {
+    printf("Cannot continue, no memory for the draw buffer.\n");
+    while(1);
+  }
 
   // Compatibility with v7 and v8 APIs
   #if LVGL_VERSION_MAJOR > 7
     static lv_disp_draw_buf_t  disp_buf;
-    lv_disp_draw_buf_init(&disp_buf, buf, NULL, LV_HOR_RES_MAX * LV_VER_RES_MAX / 6);
+    lv_disp_draw_buf_init(&disp_buf, buf1, buf2, LVGL_DRAW_BUFFER_SIZE);
 
     /*Initialize the display*/
     lv_disp_drv_init(&disp_drv);
@@ -169,7 +199,7 @@ void portenta_init_video() {
 
   #else
     static lv_disp_buf_t disp_buf;
-    lv_disp_buf_init(&disp_buf, buf, NULL, LV_HOR_RES_MAX * LV_VER_RES_MAX / 6);
+    lv_disp_buf_init(&disp_buf, buf1, buf2, LVGL_DRAW_BUFFER_SIZE);
 
     /*Initialize the display*/
     lv_disp_drv_init(&disp_drv);
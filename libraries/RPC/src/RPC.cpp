@@ -2,19 +2,36 @@
 
 static struct rpmsg_endpoint rp_endpoints[4];
 
-enum endpoints_t {
-  ENDPOINT_RAW = 0,
-  ENDPOINT_RESPONSE = 1
-};
+rpc::tx_buffer::tx_buffer(uint8_t ep) : _ep(ep), _capacity(0), _size(0), _overflow(false) {
+  _data = (uint8_t*)rpmsg_get_tx_payload_buffer(&rp_endpoints[ep], &_capacity, true);
+}
 
-void rpc::client::send_msgpack(RPCLIB_MSGPACK::sbuffer *buffer) {
-  OPENAMP_send(&rp_endpoints[ENDPOINT_RAW], (const uint8_t*)buffer->data(), buffer->size());
+rpc::tx_buffer::~tx_buffer() {
+  if (_data != NULL) {
+    rpmsg_release_tx_buffer(&rp_endpoints[_ep], _data);
+  }
+}
+
+int rpc::tx_buffer::send() {
+  if (_data == NULL) {
+    return RPMSG_ERR_NO_BUFF;
+  }
+  if (_overflow) {
+    // message does not fit a single rpmsg buffer
+    return RPMSG_ERR_BUFF_SIZE;
+  }
+  int ret = rpmsg_send_nocopy(&rp_endpoints[_ep], _data, _size);
+  if (ret >= 0) {
+    // the buffer now belongs to the other core
+    _data = NULL;
+  }
+  return ret;
 }
 
-static RingBufferN<256> intermediate_buffer;
-static RingBufferN<256> intermediate_buffer_resp;
-//static uint8_t intermediate_buffer_resp[256];
-static rtos::Mutex rx_mtx;
+// strings and binaries are referenced in the RX buffer instead of copied
+static bool reference_rx_buffer(RPCLIB_MSGPACK::type::object_type type, size_t size, void* user_data) {
+  return true;
+}
 
 static bool _init_recv_message = true;
 
@@ -30,15 +47,18 @@ int RPCClass::rpmsg_recv_callback(struct rpmsg_endpoint *ept, void *data,
       }
 #endif
 
-  rx_mtx.lock();
-  for (size_t i = 0; i < len; i++) {
-    intermediate_buffer.store_char(((uint8_t*)data)[i]);
+  rx_message_t* msg = rpc->rx_messages.try_alloc();
+  if (msg == NULL) {
+    rpc->rx_dropped++;
+    return 0;
   }
-  rx_mtx.unlock();
-
-  //memcpy(intermediate_buffer, data, len);
 
-  osSignalSet(rpc->dispatcherThreadId, len);
+  // keep the vring buffer until dispatch() is done with it
+  rpmsg_hold_rx_buffer(ept, data);
+  msg->ept = ept;
+  msg->data = (uint8_t*)data;
+  msg->len = len;
+  rpc->rx_messages.put(msg);
 
   return 0;
 }
@@ -57,14 +77,17 @@ int RPCClass::rpmsg_recv_response_callback(struct rpmsg_endpoint *ept, void *dat
       }
 #endif
 
-  rx_mtx.lock();
-  for (size_t i = 0; i < len; i++) {
-    intermediate_buffer_resp.store_char(((uint8_t*)data)[i]);
+  rx_message_t* msg = rpc->rx_responses.try_alloc();
+  if (msg == NULL) {
+    rpc->rx_dropped++;
+    return 0;
   }
-  //memcpy(intermediate_buffer_resp, data, len);
-  rx_mtx.unlock();
 
-  osSignalSet(rpc->responseThreadId, len);
+  rpmsg_hold_rx_buffer(ept, data);
+  msg->ept = ept;
+  msg->data = (uint8_t*)data;
+  msg->len = len;
+  rpc->rx_responses.put(msg);
 
   return 0;
 }
@@ -231,109 +254,207 @@ int RPCClass::begin() {
 
 #endif
 
-using raw_call_t = std::tuple<RPCLIB_MSGPACK::object>;
+int RPCClass::acquire_call(uint32_t& msgid) {
+  // the semaphore guarantees a free slot is there to be claimed
+  free_calls.acquire();
+  while (true) {
+    for (int i = 0; i < RPC_MAX_PENDING_CALLS; i++) {
+      uint8_t expected = CALL_FREE;
+      if (pending_calls[i].state.compare_exchange_strong(expected, CALL_PENDING)) {
+        msgid = call_sequence.fetch_add(1) * RPC_MAX_PENDING_CALLS + i;
+        pending_calls[i].msgid = msgid;
+        pending_calls[i].started = osKernelGetTickCount();
+        done_calls.clear(1 << i);
+        return i;
+      }
+    }
+  }
+}
 
-void RPCClass::response() {
-  responseThreadId = osThreadGetId();
+void RPCClass::complete_call(int slot, RPCLIB_MSGPACK::object const& result) {
+  pending_call& call = pending_calls[slot];
+  uint8_t state = call.state;
+  if (state == CALL_ABANDONED) {
+    release_call(slot);
+    return;
+  }
+  if (state != CALL_PENDING) {
+    // duplicated response
+    return;
+  }
+  // the result outlives the RX buffer, copy it to the slot's zone
+  call.result = RPCLIB_MSGPACK::object(result, call.zone);
+  uint8_t expected = CALL_PENDING;
+  if (call.state.compare_exchange_strong(expected, CALL_DONE)) {
+    done_calls.set(1 << slot);
+  } else {
+    // the caller dropped its future, nobody is waiting for the result
+    release_call(slot);
+  }
+}
 
-  for (int i = 0; i< 10; i++) {
-    clients[i] = NULL;
+// Frees the slots of dropped calls the other core never answered. Runs on
+// the response thread, the only other one that frees abandoned slots, and a
+// late response no longer finds its msgid once the slot is taken again
+void RPCClass::reclaim_calls() {
+  uint32_t now = osKernelGetTickCount();
+  for (int i = 0; i < RPC_MAX_PENDING_CALLS; i++) {
+    if (pending_calls[i].state == CALL_ABANDONED && now - pending_calls[i].started >= RPC_ABANDONED_CALL_TIMEOUT) {
+      release_call(i);
+    }
   }
+}
 
-  while (true) {
-    osEvent v = osSignalWait(0, osWaitForever);
+void RPCClass::release_call(int slot) {
+  pending_calls[slot].result = RPCLIB_MSGPACK::object();
+  pending_calls[slot].zone.clear();
+  pending_calls[slot].state = CALL_FREE;
+  free_calls.release();
+}
 
-{
-      RPCLIB_MSGPACK::unpacker pac;
+rpc::future::future(future&& other) : _rpc(other._rpc), _slot(other._slot) {
+  other._rpc = NULL;
+}
 
-      rx_mtx.lock();
-      int len = intermediate_buffer_resp.available();
-      for (int i = 0; i < len; i++) {
-        pac.buffer()[i] = intermediate_buffer_resp.read_char();
-      }
-      pac.buffer_consumed(len);
-      rx_mtx.unlock();
-
-      //memcpy(pac.buffer(), intermediate_buffer_resp, v.value.signals);
-      //pac.buffer_consumed(v.value.signals);
-
-      RPCLIB_MSGPACK::unpacked result;
-      while (pac.next(result)) {
-        auto r = rpc::detail::response(std::move(result));
-        auto id = r.get_id();
-        // fill the correct client stuff
-        rpc::client* client = NULL;
-        for (int i = 0; i < 10; i++) {
-          if (clients[i] != NULL) {
-            if ((uint)clients[i]->callThreadId == id) {
-              client = clients[i];
-              break;
-            }
-          }
-        }
-        if (client != NULL) {
-          client->result = std::move(*r.get_result());
-          // Unlock callThreadId thread
-          osSignalSet(client->callThreadId, 0x1);
-        }
-      }
-    }
+rpc::future& rpc::future::operator=(future&& other) {
+  if (this != &other) {
+    release();
+    _rpc = other._rpc;
+    _slot = other._slot;
+    other._rpc = NULL;
   }
+  return *this;
 }
 
-void RPCClass::dispatch() {
+rpc::future::~future() {
+  release();
+}
 
-  dispatcherThreadId = osThreadGetId();
+void rpc::future::release() {
+  if (_rpc == NULL) {
+    return;
+  }
+  uint8_t expected = RPCClass::CALL_PENDING;
+  if (!_rpc->pending_calls[_slot].state.compare_exchange_strong(expected, RPCClass::CALL_ABANDONED)) {
+    // already answered, the slot is ours to free
+    _rpc->release_call(_slot);
+  }
+  _rpc = NULL;
+}
+
+bool rpc::future::ready() const {
+  return _rpc != NULL && _rpc->pending_calls[_slot].state == RPCClass::CALL_DONE;
+}
+
+bool rpc::future::wait_for(uint32_t timeout) {
+  if (_rpc == NULL) {
+    return false;
+  }
+  if (ready()) {
+    return true;
+  }
+  uint32_t flags = _rpc->done_calls.wait_all(1 << _slot, timeout);
+  return !(flags & osFlagsError) || ready();
+}
+
+const RPCLIB_MSGPACK::object& rpc::future::result() {
+  static const RPCLIB_MSGPACK::object nil;
+  if (_rpc == NULL) {
+    return nil;
+  }
+  wait_for(osWaitForever);
+  return _rpc->pending_calls[_slot].result;
+}
+
+RPCLIB_MSGPACK::object_handle rpc::future::get() {
+  // scalars need no zone, clone() only allocates for strings and arrays
+  RPCLIB_MSGPACK::object_handle ret = RPCLIB_MSGPACK::clone(result());
+  release();
+  return ret;
+}
+
+void RPCClass::response() {
 
   while (true) {
-    osEvent v = osSignalWait(0, osWaitForever);
+    rx_message_t* msg = rx_responses.try_get_for(std::chrono::milliseconds(RPC_ABANDONED_CALL_TIMEOUT));
+    reclaim_calls();
+    if (msg == NULL) {
+      continue;
+    }
 
-{
-    RPCLIB_MSGPACK::unpacker pac;
-    rx_mtx.lock();
-    int len = intermediate_buffer.available();
-    for (int i = 0; i< len; i++) {
-      pac.buffer()[i] = intermediate_buffer.read_char();
+    size_t offset = 0;
+    try {
+      while (offset < msg->len) {
+        auto obj = RPCLIB_MSGPACK::unpack(response_zone, (const char*)msg->data, msg->len, offset,
+                                          reference_rx_buffer, NULL, RPCLIB_MSGPACK::unpack_limit());
+        rpc::detail::response::response_type r;
+        obj.convert(r);
+        uint32_t id = std::get<1>(r);
+        int slot = id % RPC_MAX_PENDING_CALLS;
+        // stale responses of dropped calls no longer match the slot
+        if (pending_calls[slot].msgid == id) {
+          complete_call(slot, std::get<3>(r));
+        }
+      }
+    } catch (RPCLIB_MSGPACK::unpack_error&) {
+      // malformed message, drop the rest of the buffer
     }
-    pac.buffer_consumed(len);
-    rx_mtx.unlock();
 
-    //memcpy(pac.buffer(), intermediate_buffer, v.value.signals);
-    //pac.buffer_consumed(v.value.signals);
+    response_zone.clear();
+    rpmsg_release_rx_buffer(msg->ept, msg->data);
+    rx_responses.free(msg);
+  }
+}
 
-    RPCLIB_MSGPACK::unpacked result;
-    while (pac.next(result)) {
-      auto msg = result.get();
-      if (msg.via.array.size == 1) {
-        // raw array
-        raw_call_t arr;
-        msg.convert(arr);
+void RPCClass::dispatch() {
 
-        std::vector<uint8_t> buf;
-        std::get<0>(arr).convert(buf);
+  while (true) {
+    rx_message_t* msg = rx_messages.try_get_for(rtos::Kernel::wait_for_u32_forever);
+    if (msg == NULL) {
+      continue;
+    }
 
-        for (size_t i = 0; i < buf.size(); i++) {
-          rx_buffer.store_char(buf[i]);
+    size_t offset = 0;
+    try {
+      while (offset < msg->len) {
+        auto obj = RPCLIB_MSGPACK::unpack(dispatch_zone, (const char*)msg->data, msg->len, offset,
+                                          reference_rx_buffer, NULL, RPCLIB_MSGPACK::unpack_limit());
+        if (obj.type != RPCLIB_MSGPACK::type::ARRAY) {
+          continue;
         }
-        // call attached function
-        if (_rx) {
-          _rx.call();
+
+        if (obj.via.array.size == 1) {
+          // raw array
+          auto const& raw = obj.via.array.ptr[0];
+          if (raw.type == RPCLIB_MSGPACK::type::BIN) {
+            rx_buffer.write((const uint8_t*)raw.via.bin.ptr, raw.via.bin.size);
+          }
+          // call attached function
+          if (_rx) {
+            _rx.call();
+          }
         }
-      }
 
-      if (msg.via.array.size > 2) {
-        auto resp = rpc::detail::dispatcher::dispatch(msg, true);
-        auto data = resp.get_data();
-        if (resp.is_empty()) {
-          //printf("no response\n");
-        } else {
-          OPENAMP_send(&rp_endpoints[ENDPOINT_RESPONSE], (const uint8_t*)data.data(), data.size());
+        if (obj.via.array.size > 2) {
+          auto resp = rpc::detail::dispatcher::dispatch(obj, true);
+          if (resp.is_empty()) {
+            //printf("no response\n");
+          } else {
+            rpc::tx_buffer buffer(ENDPOINT_RESPONSE);
+            resp.pack(buffer);
+            buffer.send();
+          }
         }
       }
+    } catch (RPCLIB_MSGPACK::unpack_error&) {
+      // malformed message, drop the rest of the buffer
     }
+
+    dispatch_zone.clear();
+    rpmsg_release_rx_buffer(msg->ept, msg->data);
+    rx_messages.free(msg);
   }
 }
-}
 
 
 size_t RPCClass::write(uint8_t c) {
@@ -345,20 +466,32 @@ size_t RPCClass::write(const uint8_t* buf, size_t len) {
   return write(ENDPOINT_RAW, buf, len);
 }
 
-size_t RPCClass::write(uint8_t ep, const uint8_t* buf, size_t len) {
+// worst case msgpack overhead of a raw message: fixarray + bin32 header
+#define RAW_MESSAGE_OVERHEAD  6
 
-  std::vector<uint8_t> tx_buffer;
-  for (size_t i = 0; i < len; i++) {
-    tx_buffer.push_back(buf[i]);
-  }
-  auto call_obj = std::make_tuple(tx_buffer);
+size_t RPCClass::write(uint8_t ep, const uint8_t* buf, size_t len) {
 
-  auto buffer = new RPCLIB_MSGPACK::sbuffer;
-  RPCLIB_MSGPACK::pack(*buffer, call_obj);
+  // pack the payload as a one element array straight into the vring
+  // buffers, splitting it when it does not fit a single rpmsg message
+  size_t written = 0;
+  do {
+    rpc::tx_buffer buffer(ep);
+    if (!buffer || buffer.capacity() <= RAW_MESSAGE_OVERHEAD) {
+      break;
+    }
+    size_t chunk = min(len - written, buffer.capacity() - RAW_MESSAGE_OVERHEAD);
+
+    RPCLIB_MSGPACK::packer<rpc::tx_buffer> pk(buffer);
+    pk.pack_array(1);
+    pk.pack_bin(chunk);
+    pk.pack_bin_body((const char*)&buf[written], chunk);
+    if (buffer.send() < 0) {
+      break;
+    }
+    written += chunk;
+  } while (written < len);
 
-  OPENAMP_send(&rp_endpoints[ep], (const uint8_t*)buffer->data(), buffer->size());
-  delete buffer;
-  return len;
+  return written;
 }
 
 arduino::RPCClass RPC;
\ No newline at end of file
@@ -34,16 +34,64 @@ extern "C" {
 }
 
 #include "mbed.h"
+#include "SPSCRingBuffer.h"
 
 typedef struct _service_request {
   uint8_t* data;
 } service_request;
 
+// rpmsg RX buffer held by the endpoint callback until a thread has
+// unpacked it in place
+typedef struct _rx_message {
+  struct rpmsg_endpoint* ept;
+  uint8_t* data;
+  size_t len;
+} rx_message_t;
+
+#ifndef RPC_RX_ZONE_CHUNK_SIZE
+#define RPC_RX_ZONE_CHUNK_SIZE  1024
+#endif
+
+// Room each pending call keeps for the strings and arrays of its result;
+// bigger results borrow from the heap until the call is collected
+#ifndef RPC_RESULT_ZONE_SIZE
+#define RPC_RESULT_ZONE_SIZE    128
+#endif
+
+// Calls in flight at the same time; a power of two, one event flag each
+#ifndef RPC_MAX_PENDING_CALLS
+#define RPC_MAX_PENDING_CALLS   16
+#endif
+
+// How long a call whose future was dropped keeps its slot waiting for the
+// response, in ms
+#ifndef RPC_ABANDONED_CALL_TIMEOUT
+#define RPC_ABANDONED_CALL_TIMEOUT   5000
+#endif
+
+// Requests from the other core that may hold a vring buffer while they wait
+// for the dispatcher; kept below VRING_NUM_BUFFS so that responses to calls
+// made from a handler still find a free buffer
+#ifndef RPC_MAX_HELD_REQUESTS
+#define RPC_MAX_HELD_REQUESTS   (VRING_NUM_BUFFS / 2)
+#endif
+
+static_assert(RPC_MAX_PENDING_CALLS <= 16 && (RPC_MAX_PENDING_CALLS & (RPC_MAX_PENDING_CALLS - 1)) == 0,
+              "RPC_MAX_PENDING_CALLS must be a power of two not larger than 16");
+static_assert(RPC_MAX_HELD_REQUESTS > 0 && RPC_MAX_HELD_REQUESTS < VRING_NUM_BUFFS,
+              "RPC_MAX_HELD_REQUESTS must leave vring buffers for responses");
+
 namespace arduino {
 
 class RPCClass : public Stream, public rpc::detail::dispatcher {
 	public:
-		RPCClass() {};
+		RPCClass() : call_sequence(0), free_calls(RPC_MAX_PENDING_CALLS), rx_dropped(0),
+		             dispatch_zone(RPC_RX_ZONE_CHUNK_SIZE), response_zone(RPC_RX_ZONE_CHUNK_SIZE) {
+			for (int i = 0; i < RPC_MAX_PENDING_CALLS; i++) {
+				pending_calls[i].state = CALL_FREE;
+				pending_calls[i].msgid = 0;
+			}
+		};
 		int begin();
 		void end() {};
 		int available(void) {
@@ -65,6 +113,12 @@ class RPCClass : public Stream, public rpc::detail::dispatcher {
 			return initialized;
 		}
 
+		// Messages from the other core thrown away because every RX slot
+		// was still taken
+		uint32_t dropped() const {
+			return rx_dropped;
+		}
+
 	    void attach(void (*fptr)(void))
 	    {
 	        if (fptr != NULL) {
@@ -73,37 +127,80 @@ class RPCClass : public Stream, public rpc::detail::dispatcher {
 	    }
 
 		template <typename... Args>
-    	RPCLIB_MSGPACK::object_handle call(std::string const &func_name,
-                                       Args... args) {
-    		// find a free spot in clients[]
-    		// create new object
-    		// protect this with mutex
-
-    		mtx.lock();
-    		int i = 0;
-    		for (i=0; i<10; i++) {
-    			if (clients[i] == NULL) {
-    				clients[i] = new rpc::client();
-    				break;
-    			}
-    		}
-    		mtx.unlock();
-
-    		// thread start and client .call
-    		clients[i]->call(func_name, args...);
-    		RPCLIB_MSGPACK::object_handle ret = std::move(clients[i]->result);
-
-    		mtx.lock();
-    		delete clients[i];
-    		clients[i] = NULL;
-    		mtx.unlock();
-    		return ret;
-    	}
-
-		rpc::client* clients[10];
+		RPCLIB_MSGPACK::object_handle call(std::string const &func_name,
+		                                   Args... args) {
+			return call_async(func_name, args...).get();
+		}
+
+		// Calls by rpc::func_id send the hash of the name instead of the
+		// name string and are dispatched through a flat table
+		template <typename... Args>
+		RPCLIB_MSGPACK::object_handle call(rpc::func_id func,
+		                                   Args... args) {
+			return call_async(func, args...).get();
+		}
+
+		// Starts a call and returns without waiting for the response; any
+		// number of calls (up to RPC_MAX_PENDING_CALLS) can be in flight,
+		// also from the same thread
+		template <typename... Args>
+		rpc::future call_async(std::string const &func_name,
+		                       Args... args) {
+			return start_call(func_name, args...);
+		}
+
+		template <typename... Args>
+		rpc::future call_async(rpc::func_id func,
+		                       Args... args) {
+			return start_call(func.value, args...);
+		}
 
 	private:
-		RingBufferN<256> rx_buffer;
+		friend class rpc::future;
+
+		enum call_state_t : uint8_t {
+			CALL_FREE = 0,
+			CALL_PENDING,
+			CALL_DONE,
+			CALL_ABANDONED
+		};
+
+		// Slot of the pending call table; the slot index is encoded in the
+		// low bits of the msgid so a response finds its call without a search.
+		// The result is copied into the slot's own zone, which is kept
+		struct pending_call {
+			pending_call() : zone(RPC_RESULT_ZONE_SIZE) {}
+			std::atomic<uint8_t> state;
+			std::atomic<uint32_t> msgid;
+			// kernel tick the call was sent at
+			uint32_t started;
+			RPCLIB_MSGPACK::zone zone;
+			RPCLIB_MSGPACK::object result;
+		};
+
+		template <typename Func, typename... Args>
+		rpc::future start_call(Func const &func, Args... args) {
+			uint32_t msgid;
+			int slot = acquire_call(msgid);
+			if (client.send_call(msgid, func, args...) < 0) {
+				complete_call(slot, RPCLIB_MSGPACK::object());
+			}
+			return rpc::future(this, slot);
+		}
+
+		int acquire_call(uint32_t& msgid);
+		void complete_call(int slot, RPCLIB_MSGPACK::object const& result);
+		void release_call(int slot);
+		void reclaim_calls();
+
+		rpc::client client;
+		pending_call pending_calls[RPC_MAX_PENDING_CALLS];
+		std::atomic<uint32_t> call_sequence;
+		rtos::Semaphore free_calls;
+		rtos::EventFlags done_calls;
+		std::atomic<uint32_t> rx_dropped;
+
+		SPSCRingBufferN<256> rx_buffer;
 		bool initialized = false;
 
 		static int rpmsg_recv_callback(struct rpmsg_endpoint *ept, void *data,
@@ -115,20 +212,21 @@ class RPCClass : public Stream, public rpc::detail::dispatcher {
 
 		void dispatch();
 		void response();
+
+		// Messages are unpacked in place from the held vring buffers; the
+		// zones only hold the object tree and are reused for every message
+		rtos::Mail<rx_message_t, RPC_MAX_HELD_REQUESTS> rx_messages;
+		rtos::Mail<rx_message_t, VRING_NUM_BUFFS> rx_responses;
+		RPCLIB_MSGPACK::zone dispatch_zone;
+		RPCLIB_MSGPACK::zone response_zone;
+
 		events::EventQueue eventQueue;
 		mbed::Ticker ticker;
 		rtos::Thread* eventThread;
 		rtos::Thread* dispatcherThread;
 		rtos::Thread* responseThread;
-		rtos::Mutex mtx;
 
 		mbed::Callback<void()> _rx;
-
-		//rpc::detail::response response;
-		RPCLIB_MSGPACK::object_handle call_result;
-
-		osThreadId dispatcherThreadId;
-		osThreadId responseThreadId;
 };
 }
 
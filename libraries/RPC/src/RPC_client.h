@@ -7,35 +7,71 @@ namespace arduino {
 class RPCClass;
 }
 
+enum endpoints_t {
+  ENDPOINT_RAW = 0,
+  ENDPOINT_RESPONSE = 1
+};
+
 namespace rpc {
-class client {
+
+// msgpack stream that packs straight into an rpmsg TX buffer taken from the
+// vring; the buffer is handed to the other core by send(), or given back
+// unsent when the object goes out of scope
+class tx_buffer {
 
   public:
-    template <typename... Args>
-    RPCLIB_MSGPACK::object_handle call(std::string const &func_name,
-                                       Args... args) {
-      LOG_DEBUG("Call function {} and wait for result", func_name);
+    tx_buffer(uint8_t ep);
+    ~tx_buffer();
+
+    void write(const char* buf, size_t len) {
+      if (_data == NULL || _size + len > _capacity) {
+        _overflow = true;
+        return;
+      }
+      memcpy(&_data[_size], buf, len);
+      _size += len;
+    }
 
-      callThreadId = osThreadGetId();
+    size_t capacity() const {
+      return _capacity;
+    }
 
-      auto args_obj = std::make_tuple(args...);
-      auto call_obj = std::make_tuple(
-                        static_cast<uint8_t>(client::request_type::request), (const int)callThreadId, func_name,
-                        args_obj);
+    operator bool() const {
+      return _data != NULL;
+    }
 
-      auto buffer = new RPCLIB_MSGPACK::sbuffer;
-      RPCLIB_MSGPACK::pack(*buffer, call_obj);
+    int send();
 
-      send_msgpack(buffer);
+  private:
+    uint8_t _ep;
+    uint8_t* _data;
+    uint32_t _capacity;
+    size_t _size;
+    bool _overflow;
+};
 
-      osSignalWait(0, osWaitForever);
+class client {
 
-      //getResult(result);
+  public:
+    //! \brief Sends a call with the given name and arguments (if any); the
+    //! response carries \p msgid back.
+    //! \param msgid The id used to match the response to the call.
+    //! \param func The name of the function to call, or the value of its
+    //! rpc::func_id.
+    //! \param args The arguments to pass to the function.
+    //! \return Negative value if the call could not be sent.
+    //! \tparam Func std::string or uint32_t.
+    //! \tparam Args The types of the arguments.
+    template <typename Func, typename... Args>
+    int send_call(uint32_t msgid, Func const &func, Args... args) {
+      LOG_DEBUG("Call function {} with id {}", func, msgid);
 
-      delete buffer;
+      auto args_obj = std::make_tuple(args...);
+      auto call_obj = std::make_tuple(
+                        static_cast<uint8_t>(client::request_type::request), msgid, func,
+                        args_obj);
 
-      RPCLIB_MSGPACK::object_handle q = std::move(result);
-      return q;
+      return send_msgpack(call_obj);
     }
 
     //! \brief Sends a notification with the given name and arguments (if any).
@@ -43,7 +79,7 @@ class client {
     //! \param args The arguments to pass to the function.
     //! \note This function returns when the notification is written to the
     //! socket.
-    //! \tparam Args THe types of the arguments.
+    //! \tparam Args The types of the arguments.
     template <typename... Args>
     void send(std::string const &func_name, Args... args) {
       LOG_DEBUG("Call function {} and forget", func_name);
@@ -53,22 +89,63 @@ class client {
                         static_cast<uint8_t>(client::request_type::request_no_answer), func_name,
                         args_obj);
 
-      auto buffer = new RPCLIB_MSGPACK::sbuffer;
-      RPCLIB_MSGPACK::pack(*buffer, call_obj);
-
-      send_msgpack(buffer);
-      delete buffer;
+      send_msgpack(call_obj);
     }
 
-  protected:
-    osThreadId callThreadId;
-    friend class arduino::RPCClass;
-    RPCLIB_MSGPACK::object_handle result;
-
   private:
     enum class request_type { raw = 1, request = 2, request_no_answer = 3,  response = 4 };
 
-    void send_msgpack(RPCLIB_MSGPACK::sbuffer *buffer);
-    void getResult(RPCLIB_MSGPACK::object_handle& res);
+    template <typename T>
+    int send_msgpack(T const &obj) {
+      tx_buffer buffer(ENDPOINT_RAW);
+      RPCLIB_MSGPACK::pack(buffer, obj);
+      return buffer.send();
+    }
+};
+
+//! \brief Completion handle of a call started with RPCClass::call_async().
+//! The result can be collected once; dropping the handle gives up on it.
+class future {
+
+  public:
+    future() : _rpc(NULL), _slot(-1) {}
+    future(future&& other);
+    future& operator=(future&& other);
+    ~future();
+
+    //! \brief True while the handle refers to a call.
+    bool valid() const {
+      return _rpc != NULL;
+    }
+
+    //! \brief True once the response has arrived, never blocks.
+    bool ready() const;
+
+    //! \brief Waits up to \p timeout ms for the response.
+    bool wait_for(uint32_t timeout);
+
+    //! \brief Waits for the response and returns its result. Strings and
+    //! arrays in it are copied to a zone of the handle's own.
+    RPCLIB_MSGPACK::object_handle get();
+
+    //! \brief Waits for the response and converts its result to \p T
+    //! straight from the call's slot, without the copy get() makes.
+    template <typename T>
+    T as() {
+      T ret = result().as<T>();
+      release();
+      return ret;
+    }
+
+  private:
+    friend class arduino::RPCClass;
+    future(arduino::RPCClass* rpc, int slot) : _rpc(rpc), _slot(slot) {}
+    future(const future&) = delete;
+    future& operator=(const future&) = delete;
+    void release();
+    const RPCLIB_MSGPACK::object& result();
+
+    arduino::RPCClass* _rpc;
+    int _slot;
 };
 }
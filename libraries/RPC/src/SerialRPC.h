@@ -20,9 +20,7 @@ public:
 	void flush(void) {};
 
 	void onWrite(std::vector<uint8_t>& vec) {
-	  for (size_t i = 0; i < vec.size(); i++) {
-	  	rx_buffer.store_char(vec[i]);
-	  }
+	  rx_buffer.write(vec.data(), vec.size());
 	  // call attached function
 	  if (_rx) {
 	    _rx.call();
@@ -45,7 +43,7 @@ public:
 		for (size_t i=0; i < len; i++) {
 			tx_buffer.push_back(buf[i]);
 		}
-		RPC.call("on_write", tx_buffer);
+		RPC.call(rpc::func_id("on_write"), tx_buffer);
 		return len;
 	}
 
@@ -72,7 +70,7 @@ public:
 
 private:
    	mbed::Callback<void()> _rx;
-	RingBufferN<1024> rx_buffer;
+	SPSCRingBufferN<1024> rx_buffer;
 	std::vector<uint8_t> tx_buffer;
 };
 }
@@ -2,6 +2,7 @@
 #include "FlashIAPBlockDevice.h"
 #include "FATFileSystem.h"
 #include "PluggableUSBMSD.h"
+#include "mbedtls/sha256.h"
 
 const unsigned char SFU[0x10000] __attribute__ ((section(".second_stage_ota"), used)) = {
 	#include "rp2040.h"
@@ -9,6 +10,11 @@ const unsigned char SFU[0x10000] __attribute__ ((section(".second_stage_ota"), u
 
 FlashIAPBlockDevice bd(XIP_BASE + 0xF00000, 0x100000);
 
+// What the second stage loader looks for, and a download in progress
+#define SFU_UPDATE_FILE		"/ota/UPDATE.BIN"
+#define SFU_PARTIAL_FILE	SFU_UPDATE_FILE ".PART"
+#define SFU_URL_FILE		SFU_UPDATE_FILE ".URL"
+
 void USBMSD::begin()
 {
     int err = getFileSystem().mount(&bd);
@@ -27,12 +33,290 @@ USBMSD MassStorage(&bd);
 
 int SFU::begin() {
 	MassStorage.begin();
+	return 0;
+}
+
+// Splits http[s]://host[:port]/path, path points into url
+static bool parse_url(const char* url, char* host, size_t host_size, uint16_t* port, const char** path) {
+	const char* p;
+	if (strncmp(url, "http://", 7) == 0) {
+		p = url + 7;
+		*port = 80;
+	} else if (strncmp(url, "https://", 8) == 0) {
+		p = url + 8;
+		*port = 443;
+	} else {
+		return false;
+	}
+	size_t len = strcspn(p, ":/");
+	if (len == 0 || len >= host_size) {
+		return false;
+	}
+	memcpy(host, p, len);
+	host[len] = '\0';
+	p += len;
+	if (*p == ':') {
+		char* end;
+		*port = strtoul(p + 1, &end, 10);
+		p = end;
+	}
+	*path = (*p == '/') ? p : "/";
+	return *p == '\0' || *p == '/';
+}
+
+// A partial download only carries on if it came from the same url
+static bool same_url(const char* url) {
+	FILE* file = fopen(SFU_URL_FILE, "rb");
+	if (file == NULL) {
+		return false;
+	}
+	bool same = true;
+	for (const char* c = url; *c != '\0' && same; c++) {
+		same = fgetc(file) == *c;
+	}
+	same = same && fgetc(file) == EOF;
+	fclose(file);
+	return same;
+}
+
+// Starts the update file over, and notes where it comes from
+static FILE* restart(FILE* file, const char* url, mbedtls_sha256_context* sha) {
+	if (file != NULL) {
+		fclose(file);
+	}
+	mbedtls_sha256_starts_ret(sha, 0);
+	FILE* url_file = fopen(SFU_URL_FILE, "wb");
+	if (url_file == NULL) {
+		return NULL;
+	}
+	bool written = fputs(url, url_file) >= 0;
+	fclose(url_file);
+	return written ? fopen(SFU_PARTIAL_FILE, "wb") : NULL;
+}
+
+// Opens the update file to carry on from its end; what is there already is
+// read back from flash to bring the hash up to date
+static FILE* resume(const char* url, mbedtls_sha256_context* sha, uint8_t* chunk, size_t chunk_size, uint32_t* offset) {
+	*offset = 0;
+	if (!same_url(url)) {
+		return restart(NULL, url, sha);
+	}
+	FILE* file = fopen(SFU_PARTIAL_FILE, "rb");
+	if (file == NULL) {
+		return restart(NULL, url, sha);
+	}
+	mbedtls_sha256_starts_ret(sha, 0);
+	size_t n;
+	while ((n = fread(chunk, 1, chunk_size, file)) > 0) {
+		mbedtls_sha256_update_ret(sha, chunk, n);
+		*offset += n;
+	}
+	fclose(file);
+	return fopen(SFU_PARTIAL_FILE, "ab");
+}
+
+static bool store(FILE* file, mbedtls_sha256_context* sha, const uint8_t* data, size_t size) {
+	mbedtls_sha256_update_ret(sha, data, size);
+	return fwrite(data, 1, size, file) == size;
+}
+
+// Sends the GET and reads the response head. On success total is the full
+// image size, and offset is where the body starts: 0 unless the server
+// honoured the Range. An offset set back to 0 drops what was kept
+static int request(Client& client, const char* url, uint32_t* offset, uint32_t* total) {
+	char host[64];
+	uint16_t port;
+	const char* path;
+	if (!parse_url(url, host, sizeof(host), &port, &path)) {
+		return SFU_ERROR_URL;
+	}
+	if (!client.connect(host, port)) {
+		return SFU_ERROR_CONNECT;
+	}
+
+	client.print("GET ");
+	client.print(path);
+	client.print(" HTTP/1.1\r\nHost: ");
+	client.print(host);
+	client.print("\r\nConnection: close\r\n");
+	if (*offset > 0) {
+		client.print("Range: bytes=");
+		client.print(*offset);
+		client.print("-\r\n");
+	}
+	client.print("\r\n");
+
+	client.setTimeout(SFU_TIMEOUT);
+	String line = client.readStringUntil('\n');
+	int status = line.substring(line.indexOf(' ') + 1).toInt();
+
+	uint32_t length = 0;
+	uint32_t range_start = 0;
+	uint32_t range_total = 0;
+	bool chunked = false;
+	while (true) {
+		line = client.readStringUntil('\n');
+		line.trim();
+		if (line.length() == 0) {
+			break;
+		}
+		String key = line.substring(0, line.indexOf(':'));
+		String value = line.substring(line.indexOf(':') + 1);
+		key.toLowerCase();
+		value.trim();
+		if (key == "content-length") {
+			length = strtoul(value.c_str(), NULL, 10);
+		} else if (key == "content-range") {
+			// bytes start-end/total
+			range_start = strtoul(value.c_str() + value.indexOf(' ') + 1, NULL, 10);
+			range_total = strtoul(value.c_str() + value.indexOf('/') + 1, NULL, 10);
+		} else if (key == "transfer-encoding") {
+			chunked = value.indexOf("chunked") >= 0;
+		}
+	}
+
+	if (status == 206 && range_start == *offset && range_total > 0) {
+		*total = range_total;
+	} else if (status == 200 && length > 0) {
+		// the whole image, whether or not a Range was asked for
+		*offset = 0;
+		*total = length;
+	} else {
+		if (status == 416) {
+			// what was kept does not fit the image any more, start over
+			*offset = 0;
+		}
+		return SFU_ERROR_HTTP;
+	}
+	return chunked ? SFU_ERROR_HTTP : 0;
+}
+
+int SFU::download(const char* url, const uint8_t* sha256) {
+	if (strncmp(url, "https://", 8) == 0) {
+		WiFiSSLClient client;
+		return download(client, url, sha256);
+	}
+	WiFiClient client;
+	return download(client, url, sha256);
+}
+
+static int fetch(Client& client, const char* url, const uint8_t* sha256) {
+	// the image never sits in RAM, only the erase unit being filled
+	size_t chunk_size = bd.get_erase_size();
+	uint8_t* chunk = (uint8_t*)malloc(chunk_size);
+	if (chunk == NULL) {
+		return SFU_ERROR_STORAGE;
+	}
+
+	mbedtls_sha256_context sha;
+	mbedtls_sha256_init(&sha);
+
+	uint32_t offset;
+	uint32_t total = 0;
+	FILE* file = resume(url, &sha, chunk, chunk_size, &offset);
+	uint32_t resumed = offset;
+	int ret = (file != NULL) ? request(client, url, &offset, &total) : SFU_ERROR_STORAGE;
+	if (ret == SFU_ERROR_HTTP && resumed > 0 && offset == 0) {
+		// a 416, what was kept does not fit the image: once more for all of it
+		client.stop();
+		file = restart(file, url, &sha);
+		resumed = 0;
+		ret = (file != NULL) ? request(client, url, &offset, &total) : SFU_ERROR_STORAGE;
+	}
+	if (file != NULL && offset != resumed) {
+		file = restart(file, url, &sha);
+		if (file == NULL && ret == 0) {
+			ret = SFU_ERROR_STORAGE;
+		}
+	}
+	if (file != NULL) {
+		// chunks go to the filesystem as they are, without another copy
+		setvbuf(file, NULL, _IONBF, 0);
+	}
+
+	// each chunk ends on an erase unit boundary of the file, the first one
+	// after a resume may be short to get back in step
+	size_t used = 0;
+	size_t limit = 0;
+	uint32_t last = millis();
+	while (ret == 0 && offset + used < total) {
+		if (used == 0) {
+			limit = chunk_size - offset % chunk_size;
+			if (limit > total - offset) {
+				limit = total - offset;
+			}
+		}
+		int n = client.read(chunk + used, limit - used);
+		if (n > 0) {
+			used += n;
+			last = millis();
+		} else if (!client.connected() || millis() - last > SFU_TIMEOUT) {
+			break;
+		} else {
+			delay(1);
+		}
+		if (used == limit) {
+			if (!store(file, &sha, chunk, used)) {
+				ret = SFU_ERROR_STORAGE;
+			}
+			offset += used;
+			used = 0;
+		}
+	}
+	// keep what did arrive for the next attempt
+	if (used > 0 && ret == 0) {
+		ret = store(file, &sha, chunk, used) ? 0 : SFU_ERROR_STORAGE;
+		offset += used;
+	}
+	client.stop();
+	free(chunk);
+	if (file != NULL) {
+		fclose(file);
+	}
+
+	uint8_t digest[32];
+	mbedtls_sha256_finish_ret(&sha, digest);
+	mbedtls_sha256_free(&sha);
+
+	if (ret != 0) {
+		return ret;
+	}
+	if (offset < total) {
+		return SFU_ERROR_INCOMPLETE;
+	}
+	if (sha256 != nullptr && memcmp(digest, sha256, sizeof(digest)) != 0) {
+		remove(SFU_PARTIAL_FILE);
+		remove(SFU_URL_FILE);
+		return SFU_ERROR_SHA256;
+	}
+	remove(SFU_UPDATE_FILE);
+	if (rename(SFU_PARTIAL_FILE, SFU_UPDATE_FILE) != 0) {
+		return SFU_ERROR_STORAGE;
+	}
+	remove(SFU_URL_FILE);
+	return total;
 }
 
-int SFU::download(const char* url) {
-	// No download at the moment, allow the user to upload a file via mass storage
+int SFU::download(Client& client, const char* url, const uint8_t* sha256) {
+	// the host must not see the filesystem change under it, and what it
+	// wrote meanwhile has to be read again
+	if (!MassStorage.eject()) {
+		return SFU_ERROR_STORAGE;
+	}
+	mbed::FATFileSystem& fs = MassStorage.getFileSystem();
+	fs.unmount();
+	int ret = (fs.mount(&bd) == 0) ? fetch(client, url, sha256) : SFU_ERROR_STORAGE;
+	MassStorage.insert();
+	return ret;
 }
 
 int SFU::apply() {
-	// No autoreboot
+	FILE* file = fopen(SFU_UPDATE_FILE, "rb");
+	if (file == NULL) {
+		return SFU_ERROR_STORAGE;
+	}
+	fclose(file);
+	MassStorage.getFileSystem().unmount();
+	NVIC_SystemReset();
+	return 0;
 }
@@ -2,9 +2,33 @@
 
 #include "WiFiNINA.h"
 
+// How long the server may stay silent before a download gives up
+#ifndef SFU_TIMEOUT
+#define SFU_TIMEOUT 10000
+#endif
+
+enum {
+	SFU_ERROR_URL        = -1,
+	SFU_ERROR_CONNECT    = -2,
+	SFU_ERROR_HTTP       = -3,
+	SFU_ERROR_STORAGE    = -4,
+	SFU_ERROR_INCOMPLETE = -5,
+	SFU_ERROR_SHA256     = -6,
+};
+
 class SFU {
 public:
 	static int begin();
-	static int download(const char* url);
+
+	// Streams the image at url (http:// or https://) into the update file the
+	// second stage loader applies, one flash erase unit at a time. An
+	// interrupted download is resumed with a Range request by calling again
+	// with the same url. When sha256 is given the image must match it.
+	// MassStorage is ejected from the host meanwhile.
+	// Returns the image size or one of the SFU_ERROR codes
+	static int download(const char* url, const uint8_t* sha256 = nullptr);
+	static int download(Client& client, const char* url, const uint8_t* sha256 = nullptr);
+
+	// Reboots into the second stage loader if an update is waiting
 	static int apply();
-};
\ No newline at end of file
+};
@@ -27,11 +27,56 @@
 #else
 #include "drivers/SPI.h"
 #endif
+#include "rtos.h"
+
+typedef struct _spi_transaction {
+  SPISettings settings;
+  int cs;
+  const void* tx;
+  void* rx;
+  size_t count;
+  mbed::Callback<void(int)> callback;
+} spi_transaction_t;
+
+#define SPI_ASYNC_IDLE  (1 << 0)
+
+// Widest frame spi_format() and the block write take natively, anything
+// wider is split into bytes
+#if defined(TARGET_STM32H7)
+#define SPI_MAX_FRAME_BITS  32
+#elif defined(TARGET_STM)
+#define SPI_MAX_FRAME_BITS  16
+#else
+#define SPI_MAX_FRAME_BITS  8
+#endif
 
 struct _mbed_spi {
   mbed::SPI* obj;
+  int bits;
+  // transferAsync() state, the worker is only started on first use
+  rtos::Mail<spi_transaction_t, SPI_ASYNC_QUEUE_SIZE> queue;
+  rtos::Thread* worker;
+  rtos::Semaphore done;
+  rtos::EventFlags idle;
+  volatile uint32_t pending;
+  volatile int event;
 };
 
+static void apply_settings(mbed_spi* dev, const SPISettings& settings) {
+    dev->obj->format(8, settings.getDataMode());
+    dev->obj->frequency(settings.getClockFreq());
+    dev->bits = 8;
+}
+
+static inline void set_frame_bits(mbed_spi* dev, int bits, const SPISettings& settings) {
+    if (dev->bits != bits) {
+        dev->obj->lock();
+        dev->obj->format(bits, settings.getDataMode());
+        dev->bits = bits;
+        dev->obj->unlock();
+    }
+}
+
 
 arduino::MbedSPI::MbedSPI(int miso, int mosi, int sck) :
   _miso(digitalPinToPinName(miso)), _mosi(digitalPinToPinName(mosi)), _sck(digitalPinToPinName(sck)) {
@@ -44,11 +89,18 @@ arduino::MbedSPI::MbedSPI(PinName miso, PinName mosi, PinName sck) : _miso(miso)
 
 uint8_t arduino::MbedSPI::transfer(uint8_t data) {
     uint8_t ret;
+    set_frame_bits(dev, 8, settings);
     dev->obj->write((const char*)&data, 1, (char*)&ret, 1);
     return ret;
 }
 
 uint16_t arduino::MbedSPI::transfer16(uint16_t data) {
+#if SPI_MAX_FRAME_BITS >= 16
+    if (settings.getBitOrder() == MSBFIRST) {
+        set_frame_bits(dev, 16, settings);
+        return dev->obj->write(data);
+    }
+#endif
 
     union { uint16_t val; struct { uint8_t lsb; uint8_t msb; }; } t;
     t.val = data;
@@ -63,10 +115,153 @@ uint16_t arduino::MbedSPI::transfer16(uint16_t data) {
     return t.val;
 }
 
+uint32_t arduino::MbedSPI::transfer32(uint32_t data) {
+#if SPI_MAX_FRAME_BITS >= 32
+    if (settings.getBitOrder() == MSBFIRST) {
+        set_frame_bits(dev, 32, settings);
+        return dev->obj->write(data);
+    }
+#endif
+    if (settings.getBitOrder() == LSBFIRST) {
+        uint32_t lo = transfer16(data & 0xFFFF);
+        return lo | ((uint32_t)transfer16(data >> 16) << 16);
+    }
+    uint32_t hi = transfer16(data >> 16);
+    return (hi << 16) | transfer16(data & 0xFFFF);
+}
+
 void arduino::MbedSPI::transfer(void *buf, size_t count) {
+    set_frame_bits(dev, 8, settings);
     dev->obj->write((const char*)buf, count, (char*)buf, count);
 }
 
+void arduino::MbedSPI::transfer(const void *tx, void *rx, size_t count) {
+    set_frame_bits(dev, 8, settings);
+    dev->obj->write((const char*)tx, tx ? count : 0, (char*)rx, rx ? count : 0);
+}
+
+void arduino::MbedSPI::transfer16(const uint16_t *tx, uint16_t *rx, size_t count) {
+#if SPI_MAX_FRAME_BITS >= 16
+    if (settings.getBitOrder() == MSBFIRST) {
+        set_frame_bits(dev, 16, settings);
+        dev->obj->write((const char*)tx, tx ? count * 2 : 0, (char*)rx, rx ? count * 2 : 0);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        uint16_t ret = transfer16(tx ? tx[i] : 0xFFFF);
+        if (rx) {
+            rx[i] = ret;
+        }
+    }
+}
+
+void arduino::MbedSPI::transfer32(const uint32_t *tx, uint32_t *rx, size_t count) {
+#if SPI_MAX_FRAME_BITS >= 32
+    if (settings.getBitOrder() == MSBFIRST) {
+        set_frame_bits(dev, 32, settings);
+        dev->obj->write((const char*)tx, tx ? count * 4 : 0, (char*)rx, rx ? count * 4 : 0);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) {
+        uint32_t ret = transfer32(tx ? tx[i] : 0xFFFFFFFF);
+        if (rx) {
+            rx[i] = ret;
+        }
+    }
+}
+
+int arduino::MbedSPI::transferAsync(const void *tx, void *rx, size_t count, mbed::Callback<void(int)> callback) {
+    return transferAsync(settings, -1, tx, rx, count, callback);
+}
+
+int arduino::MbedSPI::transferAsync(SPISettings settings, int cs, const void *tx, void *rx, size_t count, mbed::Callback<void(int)> callback) {
+    if (dev == NULL || dev->obj == NULL) {
+        return -1;
+    }
+    if (dev->worker == NULL) {
+        if (core_util_is_isr_active()) {
+            return -1;
+        }
+        dev->obj->lock();
+        if (dev->worker == NULL) {
+            dev->worker = new rtos::Thread(osPriorityAboveNormal, 2048, nullptr, "SPIAsync");
+            dev->worker->start(mbed::callback(this, &arduino::MbedSPI::asyncThd));
+        }
+        dev->obj->unlock();
+    }
+    spi_transaction_t* txn = dev->queue.try_alloc();
+    if (txn == NULL) {
+        return -1;
+    }
+    new (txn) spi_transaction_t{settings, cs, tx, rx, count, callback};
+    core_util_atomic_incr_u32(&dev->pending, 1);
+    dev->queue.put(txn);
+    return 0;
+}
+
+void arduino::MbedSPI::onAsyncEvent(int event) {
+    dev->event = event;
+    dev->done.release();
+}
+
+void arduino::MbedSPI::asyncThd() {
+    while (1) {
+        spi_transaction_t* txn = dev->queue.try_get_for(rtos::Kernel::wait_for_u32_forever);
+        if (txn == NULL) {
+            continue;
+        }
+
+        // hold the bus so that blocking transfers from other threads wait,
+        // and put back the settings they expect afterwards
+        dev->obj->lock();
+        int bits = dev->bits;
+        bool reformat = (txn->settings != settings) || bits != 8;
+        if (reformat) {
+            apply_settings(dev, txn->settings);
+        }
+        if (txn->cs >= 0) {
+            digitalWrite((pin_size_t)txn->cs, LOW);
+        }
+        int event = SPI_EVENT_COMPLETE;
+#if DEVICE_SPI_ASYNCH
+        if (dev->obj->transfer((const uint8_t*)txn->tx, txn->count, (uint8_t*)txn->rx, txn->count,
+                               mbed::callback(this, &arduino::MbedSPI::onAsyncEvent), SPI_EVENT_ALL) == 0) {
+            if (dev->done.try_acquire_for(std::chrono::milliseconds(SPI_ASYNC_TIMEOUT_MS))) {
+                event = dev->event;
+            } else {
+                dev->obj->abort_transfer();
+                // drop a completion that raced with the abort
+                dev->done.try_acquire();
+                event = SPI_EVENT_ERROR;
+            }
+        } else {
+            event = SPI_EVENT_ERROR;
+        }
+#else
+        dev->obj->write((const char*)txn->tx, txn->tx ? txn->count : 0, (char*)txn->rx, txn->rx ? txn->count : 0);
+#endif
+        if (txn->cs >= 0) {
+            digitalWrite((pin_size_t)txn->cs, HIGH);
+        }
+        if (reformat) {
+            apply_settings(dev, settings);
+            set_frame_bits(dev, bits, settings);
+        }
+        dev->obj->unlock();
+
+        if (txn->callback) {
+            txn->callback(event);
+        }
+        txn->~spi_transaction_t();
+        dev->queue.free(txn);
+        if (core_util_atomic_decr_u32(&dev->pending, 1) == 0) {
+            dev->idle.set(SPI_ASYNC_IDLE);
+        }
+    }
+}
+
 void arduino::MbedSPI::usingInterrupt(int interruptNumber) {
 
 }
@@ -76,15 +271,24 @@ void arduino::MbedSPI::notUsingInterrupt(int interruptNumber) {
 }
 
 void arduino::MbedSPI::beginTransaction(SPISettings settings) {
+    dev->obj->lock();
     if (settings != this->settings) {
-        dev->obj->format(8, settings.getDataMode());
-        dev->obj->frequency(settings.getClockFreq());
+        apply_settings(dev, settings);
         this->settings = settings;
     }
+    dev->obj->unlock();
 }
 
 void arduino::MbedSPI::endTransaction(void) {
-    // spinlock until transmission is over (if using ASYNC transfer)
+    // wait until the queued async transfers are over, unless called from
+    // one of their callbacks
+    if (dev == NULL || dev->worker == NULL || core_util_is_isr_active() ||
+        rtos::ThisThread::get_id() == dev->worker->get_id()) {
+        return;
+    }
+    while (dev->pending) {
+        dev->idle.wait_any(SPI_ASYNC_IDLE);
+    }
 }
 
 void arduino::MbedSPI::attachInterrupt() {
@@ -99,15 +303,32 @@ void arduino::MbedSPI::begin() {
     if (dev == NULL) {
       dev = new mbed_spi;
       dev->obj = NULL;
+      dev->bits = 8;
+      dev->worker = NULL;
+      dev->pending = 0;
     }
     if (dev->obj == NULL) {
       dev->obj = new mbed::SPI(_mosi, _miso, _sck);
+      dev->bits = 8;
+#if DEVICE_SPI_ASYNCH
+      dev->obj->set_dma_usage(DMA_USAGE_OPPORTUNISTIC);
+#endif
     }
 }
 
 void arduino::MbedSPI::end() {
+    if (dev == NULL) {
+        return;
+    }
+    if (dev->worker != NULL) {
+        endTransaction();
+        dev->worker->terminate();
+        delete dev->worker;
+        dev->worker = NULL;
+    }
     if (dev->obj != NULL) {
         delete dev->obj;
+        dev->obj = NULL;
     }
 }
 
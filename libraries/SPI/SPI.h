@@ -20,6 +20,17 @@
 
 #include "Arduino.h"
 #include "api/HardwareSPI.h"
+#include "platform/Callback.h"
+
+// Depth of the transferAsync() queue
+#ifndef SPI_ASYNC_QUEUE_SIZE
+#define SPI_ASYNC_QUEUE_SIZE 8
+#endif
+
+// Longest an asynchronous transfer may take before it is aborted, in ms
+#ifndef SPI_ASYNC_TIMEOUT_MS
+#define SPI_ASYNC_TIMEOUT_MS 1000
+#endif
 
 typedef struct _mbed_spi mbed_spi;
 
@@ -32,12 +43,33 @@ public:
     MbedSPI(PinName miso, PinName mosi, PinName sck);
     virtual uint8_t transfer(uint8_t data);
     virtual uint16_t transfer16(uint16_t data);
+    uint32_t transfer32(uint32_t data);
     virtual void transfer(void *buf, size_t count);
 
+    // Separate buffers: a NULL tx clocks out the default fill value, a NULL
+    // rx drops what comes back
+    void transfer(const void *tx, void *rx, size_t count);
+    // count 16 or 32-bit words, sent as single frames where the target
+    // supports that width (MSB first only)
+    void transfer16(const uint16_t *tx, uint16_t *rx, size_t count);
+    void transfer32(const uint32_t *tx, uint32_t *rx, size_t count);
+
+    // Queues a transfer to run in the background, DMA driven where the target
+    // supports asynchronous SPI. Either buffer may be NULL and both must stay
+    // valid until callback runs; it gets the SPI_EVENT_* mask from the SPI
+    // worker thread. Returns -1 when the queue is full. Can be called from an
+    // interrupt once a first call from a thread has started the worker
+    int transferAsync(const void *tx, void *rx, size_t count, mbed::Callback<void(int)> callback = nullptr);
+    // Same, with the settings and chip select of one device: cs is driven low
+    // around the transfer (-1 for none), so transfers to several devices can
+    // be queued back to back
+    int transferAsync(SPISettings settings, int cs, const void *tx, void *rx, size_t count, mbed::Callback<void(int)> callback = nullptr);
+
     // Transaction Functions
     virtual void usingInterrupt(int interruptNumber);
     virtual void notUsingInterrupt(int interruptNumber);
     virtual void beginTransaction(SPISettings settings);
+    // Also waits for the transferAsync() queue to drain
     virtual void endTransaction(void);
 
     // SPI Configuration methods
@@ -48,6 +80,9 @@ public:
     virtual void end();
 
 private:
+    void asyncThd();
+    void onAsyncEvent(int event);
+
     SPISettings settings = SPISettings(0, MSBFIRST, SPI_MODE0);
     _mbed_spi* dev = NULL;
     PinName _miso;
@@ -15,11 +15,28 @@
  */
 
 #include "Scheduler.h"
+#include "Pool.h"
 
 SchedulerClass::SchedulerClass() {
 
 }
 
+// The Thread objects come from a static pool; their stacks are still taken
+// from the heap by rtos::Thread itself
+static arduino::Pool<rtos::Thread, MAX_THREADS_NUMBER> thread_pool;
+
+rtos::Thread* SchedulerClass::newThread(uint32_t stackSize) {
+	int i = 0;
+	while (i < MAX_THREADS_NUMBER && threads[i] != NULL) {
+		i++;
+	}
+	if (i == MAX_THREADS_NUMBER) {
+		return NULL;
+	}
+	threads[i] = thread_pool.create(osPriorityNormal, stackSize);
+	return threads[i];
+}
+
 static void loophelper(SchedulerTask task) {
 	while (1) {
 		task();
@@ -27,30 +44,27 @@ static void loophelper(SchedulerTask task) {
 }
 
 void SchedulerClass::startLoop(SchedulerTask task, uint32_t stackSize) {
-	int i = 0;
-	while (threads[i] != NULL && i < MAX_THREADS_NUMBER) {
-		i++;
+	rtos::Thread* thread = newThread(stackSize);
+	if (thread == NULL) {
+		return;
 	}
-	threads[i] = new rtos::Thread(osPriorityNormal, stackSize);
-	threads[i]->start(mbed::callback(loophelper, task));
+	thread->start(mbed::callback(loophelper, task));
 }
 
 void SchedulerClass::start(SchedulerTask task, uint32_t stackSize) {
-	int i = 0;
-	while (threads[i] != NULL && i < MAX_THREADS_NUMBER) {
-		i++;
+	rtos::Thread* thread = newThread(stackSize);
+	if (thread == NULL) {
+		return;
 	}
-	threads[i] = new rtos::Thread(osPriorityNormal, stackSize);
-	threads[i]->start(task);
+	thread->start(task);
 }
 
 void SchedulerClass::start(SchedulerParametricTask task, void *taskData, uint32_t stackSize) {
-	int i = 0;
-	while (threads[i] != NULL && i < MAX_THREADS_NUMBER) {
-		i++;
+	rtos::Thread* thread = newThread(stackSize);
+	if (thread == NULL) {
+		return;
 	}
-	threads[i] = new rtos::Thread(osPriorityNormal, stackSize);
-	threads[i]->start(mbed::callback(task, taskData));
+	thread->start(mbed::callback(task, taskData));
 }
 
 SchedulerClass Scheduler;
@@ -36,6 +36,8 @@ public:
 
 	void yield() { ::yield(); };
 private:
+	rtos::Thread* newThread(uint32_t stackSize);
+
 	rtos::Thread* threads[MAX_THREADS_NUMBER] = {NULL};
 };
 
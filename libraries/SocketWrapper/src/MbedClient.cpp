@@ -1,4 +1,5 @@
 #include "MbedClient.h"
+#include "MbedServer.h"
 
 #ifndef SOCKET_TIMEOUT
 #define SOCKET_TIMEOUT 1500
@@ -12,68 +13,97 @@ uint8_t arduino::MbedClient::status() {
   return _status;
 }
 
-void arduino::MbedClient::readSocket() {
-  while (1) {
-    event->wait_any(0xFF, 100);
-    uint8_t data[SOCKET_BUFFER_SIZE];
-    int ret = NSAPI_ERROR_WOULD_BLOCK;
-    do {
-      mutex->lock();
+// Runs on the SocketIO thread: sends what write() queued, then receives
+// straight into the free room of rxBuffer until the socket has nothing more
+// or the buffer is full
+void arduino::MbedClient::onSocketEvent() {
+  const uint8_t* pending;
+  size_t len;
+  while (sock != nullptr && (len = txBuffer.read_span(pending)) > 0) {
+    nsapi_size_or_error_t ret = sock->send(pending, len);
+    if (ret > 0) {
+      txBuffer.commit_read(ret);
+      tx_event.set(1);
+      continue;
+    }
+    if (ret != NSAPI_ERROR_WOULD_BLOCK) {
+      txBuffer.clear();
+      tx_event.set(1);
+      _status = false;
+    }
+    break;
+  }
+
+  while (sock != nullptr) {
+    uint8_t* span;
+    size_t room = rxBuffer.write_span(span);
+    if (room == 0) {
+      rx_stalled = true;
+      // read() may have made room before it could see the flag
       if (rxBuffer.availableForStore() == 0) {
-        yield();
-      }
-      if (sock == nullptr || (closing && borrowed_socket)) {
-        goto cleanup;
+        return;
       }
-      ret = sock->recv(data, rxBuffer.availableForStore());
-      if (ret < 0 && ret != NSAPI_ERROR_WOULD_BLOCK) {
-        goto cleanup;
-      }
-      for (int i = 0; i < ret; i++) {
-        rxBuffer.store_char(data[i]);
-      }
-      _status = true;
-      mutex->unlock();
-    } while (ret == NSAPI_ERROR_WOULD_BLOCK || ret > 0);
+      rx_stalled = false;
+      continue;
+    }
+    nsapi_size_or_error_t ret = sock->recv(span, room);
+    if (ret > 0) {
+      rxBuffer.commit_write(ret);
+      continue;
+    }
+    if (ret != NSAPI_ERROR_WOULD_BLOCK) {
+      // 0 is an orderly close by the peer
+      _status = false;
+    }
+    return;
   }
-cleanup:
-  _status = false;
-  mutex->unlock();
-  return;
 }
 
-void arduino::MbedClient::getStatus() {
-  event->set(1);
+void arduino::MbedClient::onSigio() {
+  tx_event.set(1);
+  signal();
+}
+
+void arduino::MbedClient::rxResume() {
+  if (rx_stalled) {
+    rx_stalled = false;
+    signal();
+  }
+}
+
+// The server recycles a slot under the I/O lock, resetting its rings, so
+// callers hold the lock from this check until they are done with the rings
+arduino::MbedClient* arduino::MbedClient::connection() {
+  return _server->connection(_slot, _generation);
 }
 
 void arduino::MbedClient::setSocket(Socket *_sock) {
   sock = _sock;
+  sock->getpeername(&address);
   configureSocket(sock);
 }
 
 void arduino::MbedClient::configureSocket(Socket *_s) {
-  _s->set_timeout(0);
-  _s->set_blocking(false);
-
-  if (event == nullptr) {
-    event = new rtos::EventFlags;
+  // keep the I/O thread off the rings while they change
+  SocketIO::detach(this);
+  if (rxBuffer.capacity() != SPSCRingBuffer::capacity_for(rx_buffer_size)) {
+    rxBuffer.resize(rx_buffer_size);
   }
-  if (mutex == nullptr) {
-    mutex = new rtos::Mutex;
+  if (txBuffer.capacity() != SPSCRingBuffer::capacity_for(tx_buffer_size)) {
+    txBuffer.resize(tx_buffer_size);
   }
-  mutex->lock();
-  if (reader_th == nullptr) {
-    reader_th = new rtos::Thread;
-    reader_th->start(mbed::callback(this, &MbedClient::readSocket));
-  }
-  mutex->unlock();
-  _s->sigio(mbed::callback(this, &MbedClient::getStatus));
+  rxBuffer.clear();
+  txBuffer.clear();
+  _s->set_timeout(0);
+  _s->set_blocking(false);
+  _s->sigio(mbed::callback(this, &MbedClient::onSigio));
   _status = true;
+  SocketIO::attach(this);
 }
 
 int arduino::MbedClient::connect(SocketAddress socketAddress) {
   if (sock == nullptr) {
-    sock = new TCPSocket();
+    sock = MbedSocketClass::newTCPSocket();
     _own_socket = true;
   }
   if (sock == nullptr) {
@@ -181,99 +211,218 @@ size_t arduino::MbedClient::write(uint8_t c) {
   return write(&c, 1);
 }
 
+void arduino::MbedClient::setRxBufferSize(size_t size) {
+  rx_buffer_size = size;
+}
+
+void arduino::MbedClient::setTxBufferSize(size_t size) {
+  tx_buffer_size = size;
+}
+
+// Copies what fits of buf into txBuffer for the I/O thread to send
+size_t arduino::MbedClient::queue(const uint8_t *buf, size_t size) {
+  // cleared first, so room made from here on is not missed by a wait
+  tx_event.clear();
+  size_t queued = txBuffer.write(buf, size);
+  if (queued > 0) {
+    signal();
+  }
+  return queued;
+}
+
 size_t arduino::MbedClient::write(const uint8_t *buf, size_t size) {
+  if (_server != nullptr) {
+    // queue under the lock, but wait for room without it, the I/O thread
+    // needs it to send
+    size_t sent = 0;
+    unsigned long start = millis();
+    while (true) {
+      SocketIO::lock();
+      MbedClient* c = connection();
+      if (c != nullptr) {
+        sent += c->txBuffer.capacity() > 0 ? c->queue(&buf[sent], size - sent) : c->write(&buf[sent], size - sent);
+      }
+      SocketIO::unlock();
+      unsigned long elapsed = millis() - start;
+      if (c == nullptr || sent == size || !c->_status || elapsed >= SOCKET_TIMEOUT) {
+        return sent;
+      }
+      c->tx_event.wait_any(1, SOCKET_TIMEOUT - elapsed);
+    }
+  }
   if (sock == nullptr)
     return 0;
 
-  sock->set_blocking(true);
-  sock->set_timeout(SOCKET_TIMEOUT);
-  sock->send(buf, size);
-  configureSocket(sock);
-  return size;
+  if (txBuffer.capacity() > 0) {
+    // wait for the I/O thread to make room, as below for the socket
+    size_t sent = 0;
+    unsigned long start = millis();
+    while (true) {
+      sent += queue(&buf[sent], size - sent);
+      unsigned long elapsed = millis() - start;
+      if (sent == size || !_status || elapsed >= SOCKET_TIMEOUT) {
+        return sent;
+      }
+      tx_event.wait_any(1, SOCKET_TIMEOUT - elapsed);
+    }
+  }
+
+  // the socket stays non-blocking for the I/O thread, so wait for sigio
+  // whenever it is out of room
+  size_t sent = 0;
+  unsigned long start = millis();
+  while (sent < size) {
+    tx_event.clear();
+    SocketIO::lock();
+    nsapi_size_or_error_t ret = sock != nullptr ? sock->send(&buf[sent], size - sent) : NSAPI_ERROR_NO_SOCKET;
+    SocketIO::unlock();
+    if (ret > 0) {
+      sent += ret;
+      continue;
+    }
+    unsigned long elapsed = millis() - start;
+    if (ret != NSAPI_ERROR_WOULD_BLOCK || elapsed >= SOCKET_TIMEOUT) {
+      break;
+    }
+    tx_event.wait_any(1, SOCKET_TIMEOUT - elapsed);
+  }
+  return sent;
+}
+
+int arduino::MbedClient::availableForWrite() {
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    int ret = c != nullptr ? c->availableForWrite() : 0;
+    SocketIO::unlock();
+    return ret;
+  }
+  if (sock == nullptr) {
+    return 0;
+  }
+  // without a TX buffer the room in the socket is unknown
+  return txBuffer.capacity() > 0 ? txBuffer.availableForStore() : 0;
 }
 
 int arduino::MbedClient::available() {
-  int ret = rxBuffer.available();
-  return ret;
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    int ret = c != nullptr ? c->available() : 0;
+    SocketIO::unlock();
+    return ret;
+  }
+  return rxBuffer.available();
 }
 
 int arduino::MbedClient::read() {
-  mutex->lock();
-  if (!available()) {
-    mutex->unlock();
-    return -1;
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    int ret = c != nullptr ? c->read() : -1;
+    SocketIO::unlock();
+    return ret;
   }
-
   int ret = rxBuffer.read_char();
-  mutex->unlock();
+  if (ret >= 0) {
+    rxResume();
+  }
   return ret;
 }
 
 int arduino::MbedClient::read(uint8_t *data, size_t len) {
-  mutex->lock();
-  int avail = available();
-
-  if (!avail) {
-    mutex->unlock();
-    return -1;
-  }
-
-  if ((int)len > avail) {
-    len = avail;
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    int ret = c != nullptr ? c->read(data, len) : -1;
+    SocketIO::unlock();
+    return ret;
   }
-
-  for (size_t i = 0; i < len; i++) {
-    data[i] = rxBuffer.read_char();
+  size_t ret = rxBuffer.read(data, len);
+  if (ret == 0) {
+    return -1;
   }
-  mutex->unlock();
-
-  return len;
+  rxResume();
+  return ret;
 }
 
 int arduino::MbedClient::peek() {
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    int ret = c != nullptr ? c->peek() : -1;
+    SocketIO::unlock();
+    return ret;
+  }
   return rxBuffer.peek();
 }
 
 void arduino::MbedClient::flush() {
+  if (_server != nullptr) {
+    // waits on the I/O thread, so no lock; a recycled slot only makes
+    // it wait on the new connection's queue, bounded by SOCKET_TIMEOUT
+    MbedClient* c = connection();
+    if (c != nullptr) {
+      c->flush();
+    }
+    return;
+  }
+  unsigned long start = millis();
+  while (sock != nullptr && _status && txBuffer.available() > 0) {
+    unsigned long elapsed = millis() - start;
+    if (elapsed >= SOCKET_TIMEOUT) {
+      break;
+    }
+    tx_event.clear();
+    if (txBuffer.available() > 0) {
+      tx_event.wait_any(1, SOCKET_TIMEOUT - elapsed);
+    }
+  }
 }
 
 void arduino::MbedClient::stop() {
-  if (mutex != nullptr) {
-    mutex->lock();
+  if (_server != nullptr) {
+    _server->closeConnection(_slot, _generation);
+    _server = nullptr;
+    return;
   }
+  if (sock != nullptr && borrowed_socket == false) {
+    flush();
+    sock->sigio(nullptr);
+  }
+  SocketIO::detach(this);
   if (sock != nullptr && borrowed_socket == false) {
     if (_own_socket) {
-      delete sock;
+      MbedSocketClass::deleteSocket(sock);
     } else {
       sock->close();
     }
-    sock = nullptr;
-  }
-  closing = true;
-  if (mutex != nullptr) {
-    mutex->unlock();
-  }
-  if (reader_th != nullptr) {
-    reader_th->join();
-    delete reader_th;
-    reader_th = nullptr;
-  }
-  if (event != nullptr) {
-    delete event;
-    event = nullptr;
-  }
-  if (mutex != nullptr) {
-    delete mutex;
-    mutex = nullptr;
   }
+  sock = nullptr;
+  _own_socket = false;
   _status = false;
 }
 
 uint8_t arduino::MbedClient::connected() {
-  return _status;
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    uint8_t ret = c != nullptr && c->connected();
+    SocketIO::unlock();
+    return ret;
+  }
+  // still connected while data received before the close is unread
+  return _status || rxBuffer.available() > 0;
 }
 
 IPAddress arduino::MbedClient::remoteIP() {
+  if (_server != nullptr) {
+    SocketIO::lock();
+    MbedClient* c = connection();
+    IPAddress ret = c != nullptr ? c->remoteIP() : IPAddress();
+    SocketIO::unlock();
+    return ret;
+  }
   return SocketHelpers::ipAddressFromSocketAddress(address);
 }
 
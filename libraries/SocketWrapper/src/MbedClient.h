@@ -22,6 +22,8 @@
 
 #include "Arduino.h"
 #include "SocketHelpers.h"
+#include "SocketIO.h"
+#include "SPSCRingBuffer.h"
 #include "api/Print.h"
 #include "api/Client.h"
 #include "api/IPAddress.h"
@@ -29,21 +31,52 @@
 #include "TCPSocket.h"
 #include "rtos.h"
 
+// Default receive buffer per client
 #ifndef SOCKET_BUFFER_SIZE
 #define SOCKET_BUFFER_SIZE 256
 #endif
 
+// Default transmit buffer per client, 0 sends straight from write()
+#ifndef SOCKET_TX_BUFFER_SIZE
+#define SOCKET_TX_BUFFER_SIZE 0
+#endif
+
 namespace arduino {
 
-class MbedClient : public arduino::Client {
+class MbedServer;
+
+// The shared SocketIO thread, woken by the socket's sigio, receives into a
+// lock-free ring that read() drains and, in buffered mode, sends what
+// write() queued in another one
+class MbedClient : public arduino::Client, private SocketIOHandler {
 private:
   // Helper for copy constructor and assignment operator
   void copyClient(const MbedClient& orig) {
+    if (this == &orig) {
+      return;
+    }
+    // close a socket of our own, a server handle is only a reference
+    if (_server == nullptr && sock != nullptr) {
+      stop();
+    }
+    _server = nullptr;
+    if (orig._server != nullptr) {
+      _server = orig._server;
+      _slot = orig._slot;
+      _generation = orig._generation;
+      return;
+    }
     auto _sock = orig.sock;
+    auto _own = orig._own_socket;
     auto _m = (MbedClient*)&orig;
     _m->borrowed_socket = true;
     _m->stop();
-    this->setSocket(_sock);
+    _m->borrowed_socket = false;
+    if (_sock != nullptr) {
+      borrowed_socket = false;
+      this->setSocket(_sock);
+      _own_socket = _own;
+    }
   }
 
 public:
@@ -62,7 +95,10 @@ public:
   }  
 
   virtual ~MbedClient() {
-    stop();
+    // a client from a server only refers to the connection
+    if (_server == nullptr) {
+      stop();
+    }
   }
 
   uint8_t status();
@@ -74,6 +110,7 @@ public:
   int connectSSL(const char* host, uint16_t port);
   size_t write(uint8_t);
   size_t write(const uint8_t* buf, size_t size);
+  int availableForWrite();
   int available();
   int read();
   int read(uint8_t* buf, size_t size);
@@ -82,12 +119,20 @@ public:
   void stop();
   uint8_t connected();
   operator bool() {
-    return sock != nullptr;
+    return _server != nullptr ? connection() != nullptr : sock != nullptr;
   }
 
+  // Buffer sizes are rounded up to a power of two and applied by the next
+  // connect. With a TX buffer, write() copies into it and the I/O thread
+  // sends it; when it is full write() waits up to SOCKET_TIMEOUT for room
+  // and then returns what it took. flush() waits until it is all sent.
+  // availableForWrite() is the room in the TX buffer, 0 without one
+  void setRxBufferSize(size_t size);
+  void setTxBufferSize(size_t size);
+
   void setSocket(Socket* _sock);
   Socket* getSocket() { return sock; };
-  RingBufferN<SOCKET_BUFFER_SIZE> *getRxBuffer() { return &rxBuffer; };
+  SPSCRingBuffer *getRxBuffer() { return &rxBuffer; };
 
   void configureSocket(Socket* _s);
 
@@ -109,19 +154,32 @@ protected:
   }
 
 private:
-  RingBufferN<SOCKET_BUFFER_SIZE> rxBuffer;
-  bool _status = false;
+  SPSCRingBuffer rxBuffer;
+  SPSCRingBuffer txBuffer;
+  // set on clients handed out by MbedServer::available(), every call then
+  // goes to that connection in the server's table while it is still the
+  // same one
+  MbedServer* _server = nullptr;
+  int _slot = -1;
+  uint32_t _generation = 0;
+  size_t rx_buffer_size = SOCKET_BUFFER_SIZE;
+  size_t tx_buffer_size = SOCKET_TX_BUFFER_SIZE;
+  volatile bool _status = false;
   bool borrowed_socket = false;
   bool _own_socket = false;
-  bool closing = false;
+  // rxBuffer filled up with data possibly left in the socket
+  volatile bool rx_stalled = false;
   mbed::Callback<int(void)> beforeConnect;
   SocketAddress address;
-  rtos::Thread* reader_th = nullptr;
-  rtos::EventFlags* event = nullptr;
-  rtos::Mutex* mutex = nullptr;
-
-  void readSocket();
-  void getStatus();
+  // set by sigio and by the I/O thread when it sent from txBuffer, lets
+  // write() and flush() wait for progress
+  rtos::EventFlags tx_event;
+
+  void onSocketEvent();
+  void onSigio();
+  void rxResume();
+  size_t queue(const uint8_t* buf, size_t size);
+  MbedClient* connection();
 };
 
 }
@@ -1,55 +1,176 @@
 #include "MbedServer.h"
 #include "MbedClient.h"
 
+// A connection in the server's table; it never opens sockets itself, the
+// network is only asked for to satisfy MbedClient
+class arduino::MbedServer::Connection : public arduino::MbedClient {
+
+public:
+  Connection(MbedServer *server)
+    : owner(server) {
+    setTxBufferSize(MBED_SERVER_TX_BUFFER_SIZE);
+  }
+
+  bool handed_out = false;
+
+protected:
+  NetworkInterface *getNetwork() {
+    return owner->getNetwork();
+  }
+
+private:
+  MbedServer *owner;
+};
+
 uint8_t arduino::MbedServer::status() {
   return 0;
 }
 
 void arduino::MbedServer::begin() {
   if (sock == nullptr) {
-    sock = new TCPSocket();
+    sock = MbedSocketClass::newTCPSocket();
     ((TCPSocket *)sock)->open(getNetwork());
   }
   if (sock) {
-    sock->bind(_port);
-    sock->listen(5);
     sock->set_blocking(false);
+    sock->bind(_port);
+    sock->listen(MBED_SERVER_MAX_CLIENTS);
+    sock->sigio(mbed::callback(this, &MbedServer::onSigio));
+    SocketIO::attach(this);
   }
 }
 
-size_t arduino::MbedServer::write(uint8_t c) {
+void arduino::MbedServer::end() {
   if (sock) {
-    sock->send(&c, 1);
-    return 1;
+    sock->sigio(nullptr);
+  }
+  SocketIO::detach(this);
+  for (int i = 0; i < MBED_SERVER_MAX_CLIENTS; i++) {
+    delete clients[i];
+    clients[i] = nullptr;
+    generations[i]++;
+  }
+  if (sock) {
+    MbedSocketClass::deleteSocket(sock);
+    sock = nullptr;
   }
-  return 0;
 }
 
-size_t arduino::MbedServer::write(const uint8_t *buf, size_t size) {
-  if (sock) {
-    sock->send(buf, size);
-    return size;
+void arduino::MbedServer::onSigio() {
+  signal();
+}
+
+// Runs on the SocketIO thread
+void arduino::MbedServer::onSocketEvent() {
+  while (sock != nullptr) {
+    nsapi_error_t error;
+    TCPSocket *client = sock->accept(&error);
+    if (client == nullptr) {
+      return;
+    }
+    int slot = freeSlot();
+    if (slot < 0) {
+      client->close();
+      continue;
+    }
+    if (clients[slot] == nullptr) {
+      clients[slot] = new Connection(this);
+    }
+    generations[slot]++;
+    clients[slot]->handed_out = false;
+    clients[slot]->setSocket(client);
   }
-  return 0;
 }
 
+// Connection objects are reused rather than deleted, the SocketIO thread
+// may be walking past them
+int arduino::MbedServer::freeSlot() {
+  for (int i = 0; i < MBED_SERVER_MAX_CLIENTS; i++) {
+    if (clients[i] == nullptr) {
+      return i;
+    }
+    if (!clients[i]->connected()) {
+      clients[i]->stop();
+      generations[i]++;
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool arduino::MbedServer::nextClient(MbedClient &client) {
+  int found = -1;
+  SocketIO::lock();
+  for (int i = 0; i < MBED_SERVER_MAX_CLIENTS && found < 0; i++) {
+    int slot = (next_client + i) % MBED_SERVER_MAX_CLIENTS;
+    if (clients[slot] != nullptr && clients[slot]->available() > 0) {
+      found = slot;
+    }
+  }
+  for (int slot = 0; slot < MBED_SERVER_MAX_CLIENTS && found < 0; slot++) {
+    if (clients[slot] != nullptr && !clients[slot]->handed_out && clients[slot]->connected()) {
+      found = slot;
+    }
+  }
+  if (found >= 0) {
+    clients[found]->handed_out = true;
+    next_client = (found + 1) % MBED_SERVER_MAX_CLIENTS;
+    client._server = this;
+    client._slot = found;
+    client._generation = generations[found];
+  }
+  SocketIO::unlock();
+  return found >= 0;
+}
 
-// MUST be reimplemented (just copy/paste and replace MbedClient to *Client) since MbedClient is abstract
+arduino::MbedClient *arduino::MbedServer::connection(int slot, uint32_t generation) {
+  return generations[slot] == generation ? clients[slot] : nullptr;
+}
 
-/*
-arduino::MbedClient arduino::MbedServer::available(uint8_t* status) {
-	MbedClient client;
-	nsapi_error_t error;
-	if (sock == nullptr) {
-		return client;
-	}
-	TCPSocket* clientSocket = sock->accept(&error);
-	if(status != nullptr) {
-		*status = error == NSAPI_ERROR_OK ? 1 : 0;
-	}
-	if (error == NSAPI_ERROR_OK) {
-		client.setSocket(clientSocket);
-	}
-	return client;
+void arduino::MbedServer::closeConnection(int slot, uint32_t generation) {
+  MbedClient *client = connection(slot, generation);
+  if (client == nullptr) {
+    return;
+  }
+  // flush without the lock, the SocketIO thread is the one sending
+  client->flush();
+  SocketIO::lock();
+  if (generations[slot] == generation) {
+    client->stop();
+    generations[slot]++;
+  }
+  SocketIO::unlock();
+}
+
+int arduino::MbedServer::clientCount() {
+  int count = 0;
+  SocketIO::lock();
+  for (int i = 0; i < MBED_SERVER_MAX_CLIENTS; i++) {
+    if (clients[i] != nullptr && clients[i]->connected()) {
+      count++;
+    }
+  }
+  SocketIO::unlock();
+  return count;
+}
+
+size_t arduino::MbedServer::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+// Queues buf to every open connection without waiting for any of them,
+// returns the most any of them took
+size_t arduino::MbedServer::write(const uint8_t *buf, size_t size) {
+  size_t ret = 0;
+  SocketIO::lock();
+  for (int i = 0; i < MBED_SERVER_MAX_CLIENTS; i++) {
+    if (clients[i] != nullptr && clients[i]->connected()) {
+      size_t queued = clients[i]->queue(buf, size);
+      if (queued > ret) {
+        ret = queued;
+      }
+    }
+  }
+  SocketIO::unlock();
+  return ret;
 }
-*/
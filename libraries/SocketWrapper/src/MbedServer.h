@@ -19,6 +19,7 @@
 
 #include "Arduino.h"
 #include "SocketHelpers.h"
+#include "SocketIO.h"
 #include "mbed.h"
 #include "api/Print.h"
 #include "api/Client.h"
@@ -26,40 +27,72 @@
 #include "TLSSocket.h"
 #include "TCPSocket.h"
 
+// Connections kept open at the same time, further ones are closed as soon
+// as they are accepted
+#ifndef MBED_SERVER_MAX_CLIENTS
+#define MBED_SERVER_MAX_CLIENTS 4
+#endif
+
+// Per connection queue for write(), a client that falls this far behind
+// misses data instead of stalling the others, so it must not be 0
+#ifndef MBED_SERVER_TX_BUFFER_SIZE
+#define MBED_SERVER_TX_BUFFER_SIZE 1024
+#endif
+
 namespace arduino {
 
 class MbedClient;
 
-class MbedServer : public arduino::Server {
+// Accepts connections from the SocketIO thread, woken by the listening
+// socket's sigio, and keeps them in a fixed table. available() hands out
+// clients that refer to a connection in the table, which stays owned by the
+// server, and write() queues to every open connection
+class MbedServer : public arduino::Server, private SocketIOHandler {
 
 protected:
   virtual NetworkInterface *getNetwork() = 0;
   TCPSocket *sock = nullptr;
   uint16_t _port;
 
+  // Points client at the next connection with unread data or, failing
+  // that, at a new one that was not handed out yet
+  bool nextClient(MbedClient& client);
+
 public:
   MbedServer(uint16_t port)
     : _port(port){};
 
   virtual ~MbedServer() {
-    if (sock) {
-      delete sock;
-      sock = nullptr;
-    }
+    end();
   }
   void begin();
+  void end();
   virtual size_t write(uint8_t);
   virtual size_t write(const uint8_t *buf, size_t size);
   uint8_t status();
 
-  //virtual MbedClient available(uint8_t* status) = 0;
+  // Open connections
+  int clientCount();
 
   using Print::write;
 
   friend class MbedSocketClass;
   friend class MbedClient;
+
+private:
+  class Connection;
+
+  Connection *clients[MBED_SERVER_MAX_CLIENTS] = {};
+  uint32_t generations[MBED_SERVER_MAX_CLIENTS] = {};
+  int next_client = 0;
+
+  void onSocketEvent();
+  void onSigio();
+  int freeSlot();
+  MbedClient *connection(int slot, uint32_t generation);
+  void closeConnection(int slot, uint32_t generation);
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
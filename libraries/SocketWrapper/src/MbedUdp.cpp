@@ -1,19 +1,43 @@
 #include "MbedUdp.h"
 
-arduino::MbedUDP::MbedUDP() {
-  _packet_buffer = new uint8_t[WIFI_UDP_BUFFER_SIZE];
+#ifndef SOCKET_TIMEOUT
+#define SOCKET_TIMEOUT 1500
+#endif
+
+arduino::MbedUDP::MbedUDP()
+  : rx_head(0), rx_tail(0) {
+  _packet_buffer = NULL;
   _current_packet = NULL;
   _current_packet_size = 0;
-  // if this allocation fails then ::begin will fail
 }
 
 arduino::MbedUDP::~MbedUDP() {
-  delete[] _packet_buffer;
+  stop();
+  delete[] rx_slots;
 }
 
 uint8_t arduino::MbedUDP::begin(uint16_t port) {
   // success = 1, fail = 0
 
+  // keep the I/O thread off the slots while they change
+  SocketIO::detach(this);
+  releasePacket();
+  // at least one slot, the ring is masked with rx_count - 1
+  size_t count = SPSCRingBuffer::capacity_for(rx_packets > 0 ? rx_packets : 1);
+  if (rx_count != count) {
+    delete[] rx_slots;
+    rx_count = count;
+    rx_slots = new RxSlot[rx_count];
+  }
+  // if this allocation fails then ::begin will fail
+  if (!rx_slots) {
+    rx_count = 0;
+    return 0;
+  }
+  rx_head.store(0, std::memory_order_relaxed);
+  rx_tail.store(0, std::memory_order_relaxed);
+  rx_stalled = false;
+
   nsapi_error_t rt = _socket.open(getNetwork());
   if (rt != NSAPI_ERROR_OK) {
     return 0;
@@ -23,12 +47,10 @@ uint8_t arduino::MbedUDP::begin(uint16_t port) {
     return 0;  //Failed to bind UDP Socket to port
   }
 
-  if (!_packet_buffer) {
-    return 0;
-  }
-
   _socket.set_blocking(false);
   _socket.set_timeout(0);
+  _socket.sigio(mbed::callback(this, &MbedUDP::onSigio));
+  SocketIO::attach(this);
 
   return 1;
 }
@@ -50,38 +72,106 @@ uint8_t arduino::MbedUDP::beginMulticast(IPAddress ip, uint16_t port) {
 }
 
 void arduino::MbedUDP::stop() {
+  _socket.sigio(nullptr);
+  SocketIO::detach(this);
   _socket.close();
+  releasePacket();
+}
+
+void arduino::MbedUDP::setRxPacketCount(size_t count) {
+  rx_packets = count;
+}
+
+// Runs on the SocketIO thread: receives datagrams into free slots until the
+// socket has nothing more or the ring is full
+void arduino::MbedUDP::onSocketEvent() {
+  while (rx_slots != nullptr) {
+    size_t head = rx_head.load(std::memory_order_relaxed);
+    if (head - rx_tail.load(std::memory_order_acquire) == rx_count) {
+      rx_stalled = true;
+      // parsePacket() may have freed a slot before it could see the flag
+      if (head - rx_tail.load(std::memory_order_acquire) == rx_count) {
+        return;
+      }
+      rx_stalled = false;
+    }
+    RxSlot& slot = rx_slots[head & (rx_count - 1)];
+    nsapi_size_or_error_t ret = _socket.recvfrom(&slot.from, slot.data, WIFI_UDP_BUFFER_SIZE);
+    if (ret < 0) {
+      return;
+    }
+    // an empty datagram is nothing parsePacket() could report
+    if (ret == 0) {
+      continue;
+    }
+    slot.size = ret;
+    rx_head.store(head + 1, std::memory_order_release);
+  }
+}
+
+void arduino::MbedUDP::onSigio() {
+  tx_event.set(1);
+  signal();
+}
+
+// Hands the slot parsePacket() holds back to the I/O thread
+void arduino::MbedUDP::releasePacket() {
+  _current_packet = NULL;
+  _current_packet_size = 0;
+  if (!rx_holding) {
+    return;
+  }
+  rx_holding = false;
+  rx_tail.store(rx_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  rxResume();
+}
+
+void arduino::MbedUDP::rxResume() {
+  if (rx_stalled) {
+    rx_stalled = false;
+    signal();
+  }
 }
 
 int arduino::MbedUDP::beginPacket(IPAddress ip, uint16_t port) {
   _host = SocketHelpers::socketAddressFromIpAddress(ip, port);
   //If IP is null and port is 0 the initialization failed
-  txBuffer.clear();
+  _tx_size = 0;
   return (_host.get_ip_address() == nullptr && _host.get_port() == 0) ? 0 : 1;
 }
 
 int arduino::MbedUDP::beginPacket(const char *host, uint16_t port) {
   _host = SocketAddress(host, port);
-  txBuffer.clear();
+  _tx_size = 0;
   getNetwork()->gethostbyname(host, &_host);
   //If IP is null and port is 0 the initialization failed
   return (_host.get_ip_address() == nullptr && _host.get_port() == 0) ? 0 : 1;
 }
 
-int arduino::MbedUDP::endPacket() {
-  _socket.set_blocking(true);
-  _socket.set_timeout(1000);
-
-  size_t size = txBuffer.available();
-  uint8_t buffer[size];
-  for (int i = 0; i < size; i++) {
-    buffer[i] = txBuffer.read_char();
+// The socket stays non-blocking for the I/O thread, so wait for sigio
+// whenever it is out of room
+int arduino::MbedUDP::sendPacket(const SocketAddress &host, const uint8_t *data, size_t size) {
+  unsigned long start = millis();
+  while (1) {
+    tx_event.clear();
+    SocketIO::lock();
+    nsapi_size_or_error_t ret = _socket.sendto(host, data, size);
+    SocketIO::unlock();
+    if (ret >= 0) {
+      return 1;
+    }
+    unsigned long elapsed = millis() - start;
+    if (ret != NSAPI_ERROR_WOULD_BLOCK || elapsed >= SOCKET_TIMEOUT) {
+      return 0;
+    }
+    tx_event.wait_any(1, SOCKET_TIMEOUT - elapsed);
   }
+}
 
-  nsapi_size_or_error_t ret = _socket.sendto(_host, buffer, size);
-  _socket.set_blocking(false);
-  _socket.set_timeout(0);
-  if (ret < 0) {
+int arduino::MbedUDP::endPacket() {
+  size_t size = _tx_size;
+  _tx_size = 0;
+  if (!sendPacket(_host, _tx_buffer, size)) {
     return 0;
   }
   return size;
@@ -94,35 +184,82 @@ size_t arduino::MbedUDP::write(uint8_t byte) {
 
 // Write size bytes from buffer into the packet
 size_t arduino::MbedUDP::write(const uint8_t *buffer, size_t size) {
-  for (int i = 0; i<size; i++) {
-    if (txBuffer.availableForStore()) {
-      txBuffer.store_char(buffer[i]);
-    } else {
-      return 0;
-    }
+  size_t room;
+  uint8_t *span = writeSpan(room);
+  if (size > room) {
+    return 0;
   }
+  memcpy(span, buffer, size);
+  commitWrite(size);
   return size;
 }
 
+uint8_t *arduino::MbedUDP::writeSpan(size_t &room) {
+  room = WIFI_UDP_BUFFER_SIZE - _tx_size;
+  return &_tx_buffer[_tx_size];
+}
+
+void arduino::MbedUDP::commitWrite(size_t len) {
+  _tx_size += len;
+}
+
+size_t arduino::MbedUDP::sendBatch(const Packet *packets, size_t count) {
+  size_t sent = 0;
+  while (sent < count) {
+    const Packet &packet = packets[sent];
+    SocketAddress host = SocketHelpers::socketAddressFromIpAddress(packet.ip, packet.port);
+    if (!sendPacket(host, packet.data, packet.size)) {
+      break;
+    }
+    sent++;
+  }
+  return sent;
+}
+
+size_t arduino::MbedUDP::recvBatch(Packet *packets, size_t count) {
+  releasePacket();
+  size_t received = 0;
+  while (received < count && rx_slots != nullptr) {
+    size_t tail = rx_tail.load(std::memory_order_relaxed);
+    if (rx_head.load(std::memory_order_acquire) == tail) {
+      break;
+    }
+    RxSlot &slot = rx_slots[tail & (rx_count - 1)];
+    Packet &packet = packets[received++];
+    if (packet.size > slot.size) {
+      packet.size = slot.size;
+    }
+    memcpy(packet.data, slot.data, packet.size);
+    packet.ip = SocketHelpers::ipAddressFromSocketAddress(slot.from);
+    packet.port = slot.from.get_port();
+    rx_tail.store(tail + 1, std::memory_order_release);
+  }
+  if (received > 0) {
+    rxResume();
+  }
+  return received;
+}
+
 int arduino::MbedUDP::parsePacket() {
-  nsapi_size_or_error_t ret = _socket.recvfrom(&_remoteHost, _packet_buffer, WIFI_UDP_BUFFER_SIZE);
+  // done with the packet held so far
+  releasePacket();
 
-  if (ret == NSAPI_ERROR_WOULD_BLOCK) {
-    // no data
+  if (rx_slots == nullptr) {
     return 0;
-  } else if (ret == NSAPI_ERROR_NO_SOCKET) {
-    // socket was not created correctly.
-    return -1;
   }
-  // error codes below zero are errors
-  else if (ret <= 0) {
-    // something else went wrong, need some tracing info...
-    return -1;
+  size_t tail = rx_tail.load(std::memory_order_relaxed);
+  if (rx_head.load(std::memory_order_acquire) == tail) {
+    // no data
+    return 0;
   }
 
   // set current packet states
+  RxSlot &slot = rx_slots[tail & (rx_count - 1)];
+  rx_holding = true;
+  _remoteHost = slot.from;
+  _packet_buffer = slot.data;
   _current_packet = _packet_buffer;
-  _current_packet_size = ret;
+  _current_packet_size = slot.size;
 
   return _current_packet_size;
 }
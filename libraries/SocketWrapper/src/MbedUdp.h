@@ -22,7 +22,10 @@
 
 #include "Arduino.h"
 #include "SocketHelpers.h"
+#include "SocketIO.h"
+#include "SPSCRingBuffer.h"
 #include "api/Udp.h"
+#include <atomic>
 
 #include "netsocket/SocketAddress.h"
 #include "netsocket/UDPSocket.h"
@@ -31,22 +34,66 @@
 #define WIFI_UDP_BUFFER_SIZE 508
 #endif
 
+// Datagrams that can wait for parsePacket(), each takes WIFI_UDP_BUFFER_SIZE
+#ifndef WIFI_UDP_RX_PACKETS
+#define WIFI_UDP_RX_PACKETS 4
+#endif
+
 namespace arduino {
 
-class MbedUDP : public UDP {
+// The shared SocketIO thread, woken by the socket's sigio, receives every
+// datagram into a ring of packet slots that parsePacket() steps through, so
+// packets arriving between two parsePacket() calls wait instead of being lost
+class MbedUDP : public UDP, private SocketIOHandler {
+public:
+  // One datagram for sendBatch() and recvBatch()
+  struct Packet {
+    IPAddress ip;
+    uint16_t port;
+    uint8_t* data;
+    size_t size;
+  };
+
 private:
+  struct RxSlot {
+    SocketAddress from;
+    size_t size;
+    uint8_t data[WIFI_UDP_BUFFER_SIZE];
+  };
+
   UDPSocket _socket;          // Mbed OS socket
   SocketAddress _host;        // Host to be used to send data
   SocketAddress _remoteHost;  // Remote host that sent incoming packets
 
-  uint8_t* _packet_buffer;  // Raw packet buffer (contains data we got from the UDPSocket)
+  // Filled by the I/O thread at rx_head, parsePacket() holds the slot at
+  // rx_tail until the next one is asked for
+  RxSlot* rx_slots = nullptr;
+  size_t rx_count = 0;
+  size_t rx_packets = WIFI_UDP_RX_PACKETS;
+  std::atomic<size_t> rx_head;
+  std::atomic<size_t> rx_tail;
+  bool rx_holding = false;
+  // the ring filled up with datagrams possibly left in the socket
+  volatile bool rx_stalled = false;
+
+  uint8_t* _packet_buffer;  // Data of the packet parsePacket() holds
 
   // The Arduino APIs allow you to iterate through this buffer, so we need to be able to iterate over the current packet
   // these two variables are used to cache the state of the current packet
   uint8_t* _current_packet;
   size_t _current_packet_size;
 
-  RingBufferN<WIFI_UDP_BUFFER_SIZE> txBuffer;
+  // The packet being built, sent as it is by endPacket()
+  uint8_t _tx_buffer[WIFI_UDP_BUFFER_SIZE];
+  size_t _tx_size = 0;
+  // set by sigio, lets a send wait for room in the socket
+  rtos::EventFlags tx_event;
+
+  void onSocketEvent();
+  void onSigio();
+  void releasePacket();
+  void rxResume();
+  int sendPacket(const SocketAddress& host, const uint8_t* data, size_t size);
 
 protected:
   virtual NetworkInterface* getNetwork() = 0;
@@ -73,6 +120,10 @@ public:
   virtual size_t write(uint8_t);
   // Write size bytes from buffer into the packet
   virtual size_t write(const uint8_t* buffer, size_t size);
+  // Points room at the free part of the packet being built, to be filled in
+  // place and then committed
+  uint8_t* writeSpan(size_t& room);
+  void commitWrite(size_t len);
 
   using Print::write;
 
@@ -100,6 +151,18 @@ public:
   // // Return the port of the host who sent the current incoming packet
   virtual uint16_t remotePort();
 
+  // Number of receive slots, rounded up to a power of two and applied by the
+  // next begin()
+  void setRxPacketCount(size_t count);
+
+  // Sends each packet to its ip and port straight from its data, returns how
+  // many were sent before the first failure
+  size_t sendBatch(const Packet* packets, size_t count);
+  // Moves up to count received datagrams into the buffers given by data and
+  // size, setting size, ip and port of each; longer datagrams are truncated.
+  // Also finishes the packet parsePacket() holds. Returns how many were moved
+  size_t recvBatch(Packet* packets, size_t count);
+
   friend class MbedSocketClass;
 };
 
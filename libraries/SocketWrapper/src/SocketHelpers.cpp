@@ -1,4 +1,20 @@
 #include "SocketHelpers.h"
+#include "Pool.h"
+
+static arduino::Pool<TCPSocket, SOCKET_POOL_SIZE> tcp_socket_pool;
+
+TCPSocket* arduino::MbedSocketClass::newTCPSocket() {
+  TCPSocket* sock = tcp_socket_pool.create();
+  return sock != nullptr ? sock : new TCPSocket();
+}
+
+void arduino::MbedSocketClass::deleteSocket(Socket* sock) {
+  if (tcp_socket_pool.owns(sock)) {
+    tcp_socket_pool.destroy(static_cast<TCPSocket*>(sock));
+  } else {
+    delete sock;
+  }
+}
 
 uint8_t* arduino::MbedSocketClass::macAddress(uint8_t* mac) {
   const char* mac_str = getNetwork()->get_mac_address();
@@ -19,6 +19,13 @@
 
 #include "Arduino.h"
 #include "netsocket/NetworkInterface.h"
+#include "netsocket/TCPSocket.h"
+
+// TCPSockets owned by the wrappers come from a static pool of this many,
+// further ones from the heap
+#ifndef SOCKET_POOL_SIZE
+#define SOCKET_POOL_SIZE 4
+#endif
 
 namespace arduino {
 
@@ -129,6 +136,9 @@ protected:
 
   static arduino::IPAddress ipAddressFromSocketAddress(SocketAddress socketAddress);
   static SocketAddress socketAddressFromIpAddress(arduino::IPAddress ip, uint16_t port);
+
+  static TCPSocket* newTCPSocket();
+  static void deleteSocket(Socket* sock);
 };
 
 using SocketHelpers = MbedSocketClass;
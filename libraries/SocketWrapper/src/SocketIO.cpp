@@ -0,0 +1,73 @@
+#include "SocketIO.h"
+
+#define SOCKET_IO_WAKE 1
+
+static rtos::Mutex io_mutex;
+static rtos::EventFlags io_event;
+static rtos::Thread* io_thread = nullptr;
+static arduino::SocketIOHandler* handlers = nullptr;
+
+void arduino::SocketIOHandler::signal() {
+  _pending = true;
+  SocketIO::wake();
+}
+
+void arduino::SocketIO::wake() {
+  io_event.set(SOCKET_IO_WAKE);
+}
+
+void arduino::SocketIO::attach(SocketIOHandler* handler) {
+  io_mutex.lock();
+  if (!handler->_attached) {
+    handler->_next = handlers;
+    handlers = handler;
+    handler->_attached = true;
+  }
+  if (io_thread == nullptr) {
+    io_thread = new rtos::Thread(osPriorityNormal, SOCKET_IO_STACK_SIZE, nullptr, "SocketIO");
+    io_thread->start(loop);
+  }
+  io_mutex.unlock();
+  // data may have arrived before sigio was hooked up
+  handler->signal();
+}
+
+void arduino::SocketIO::detach(SocketIOHandler* handler) {
+  io_mutex.lock();
+  for (SocketIOHandler** link = &handlers; *link != nullptr; link = &(*link)->_next) {
+    if (*link == handler) {
+      *link = handler->_next;
+      break;
+    }
+  }
+  // _next is left alone: loop() may be about to step from this handler to
+  // the rest of the list
+  handler->_pending = false;
+  handler->_attached = false;
+  io_mutex.unlock();
+}
+
+void arduino::SocketIO::lock() {
+  io_mutex.lock();
+}
+
+void arduino::SocketIO::unlock() {
+  io_mutex.unlock();
+}
+
+void arduino::SocketIO::loop() {
+  while (1) {
+    io_event.wait_any(SOCKET_IO_WAKE);
+    io_mutex.lock();
+    SocketIOHandler* next;
+    for (SocketIOHandler* handler = handlers; handler != nullptr; handler = next) {
+      // a handler may detach itself
+      next = handler->_next;
+      if (handler->_pending) {
+        handler->_pending = false;
+        handler->onSocketEvent();
+      }
+    }
+    io_mutex.unlock();
+  }
+}
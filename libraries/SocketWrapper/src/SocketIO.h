@@ -0,0 +1,78 @@
+/*
+  SocketIO.h - Shared I/O thread for mbed Sockets
+  Copyright (c) 2021 Arduino SA.  All right reserved.
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef SOCKETIO_H
+#define SOCKETIO_H
+
+#include "Arduino.h"
+#include "mbed.h"
+
+#ifndef SOCKET_IO_STACK_SIZE
+#define SOCKET_IO_STACK_SIZE OS_STACK_SIZE
+#endif
+
+namespace arduino {
+
+/*
+  Anything that owns a socket and wants to be serviced by the shared I/O
+  thread: it calls signal() from the socket's sigio callback and gets
+  onSocketEvent() on the I/O thread, one handler at a time.
+*/
+class SocketIOHandler {
+
+public:
+  virtual ~SocketIOHandler() {}
+
+protected:
+  // Runs on the I/O thread with the I/O lock held, never blocks
+  virtual void onSocketEvent() = 0;
+
+  // Schedules onSocketEvent(), safe from sigio callbacks and any thread
+  void signal();
+
+private:
+  friend class SocketIO;
+
+  SocketIOHandler* _next = nullptr;
+  volatile bool _pending = false;
+  bool _attached = false;
+};
+
+class SocketIO {
+
+public:
+  // Starts servicing handler, the thread is created on first use
+  static void attach(SocketIOHandler* handler);
+
+  // Stops servicing handler; when this returns its onSocketEvent() is not
+  // running and will not run again
+  static void detach(SocketIOHandler* handler);
+
+  // Held around every call into a serviced socket from other threads, as
+  // neither the sockets nor TLS cope with two threads at once
+  static void lock();
+  static void unlock();
+
+private:
+  friend class SocketIOHandler;
+
+  static void wake();
+  static void loop();
+};
+
+}
+
+#endif
@@ -41,6 +41,17 @@
 #define MSD_MAX_PACKET_SIZE    64
 #endif
 
+// Sectors held in RAM, so that consecutive ones are read ahead and written
+// back in one erase and program of the block device. Halved until it can be
+// allocated, down to one sector
+#ifndef USBMSD_CACHE_SECTORS
+#ifdef NRF52840_XXAA
+#define USBMSD_CACHE_SECTORS   4
+#else
+#define USBMSD_CACHE_SECTORS   8
+#endif
+#endif
+
 namespace arduino {
 
 /**
@@ -148,6 +159,21 @@ public:
     */
     bool media_removed();
 
+    /**
+    * Take the medium away from the host, so the block device can be written
+    * from the sketch. A command the host is in the middle of is let finish
+    * and the sector cache is written back first.
+    *
+    * @returns false if the host stayed busy and the medium is still shared
+    */
+    bool eject();
+
+    /**
+    * Give the medium back to the host after eject(). The host is told it
+    * may have changed, so it reads the filesystem again.
+    */
+    void insert();
+
 protected:
 
     /*
@@ -233,6 +259,15 @@ private:
     // If msd device has been unmounted by host
     volatile bool _media_removed;
 
+    // taken away from the host by eject() until insert(), and not yet
+    // reported to the host as changed since
+    bool _ejected;
+    bool _media_changed;
+
+    // sense data the next REQUEST_SENSE returns
+    uint8_t _sense_key;
+    uint8_t _sense_asc;
+
     //state of the bulk-only state machine
     Stage _stage;
 
@@ -251,8 +286,18 @@ private:
     // memory OK (after a memoryVerify)
     bool _mem_ok;
 
-    // cache in RAM before writing in memory. Useful also to read a block.
-    uint8_t *_page;
+    // run of consecutive sectors in RAM, starting at _cache_lba: read ahead
+    // from memory, or written by the host and not programmed yet if dirty
+    uint8_t *_cache;
+    uint32_t _cache_sectors;
+    uint64_t _cache_lba;
+    uint32_t _cache_count;
+    bool _cache_dirty;
+    // a write back failed and has not been reported to the host yet
+    bool _cache_error;
+
+    // sector after the last read command, to tell sequential reads
+    uint64_t _read_lba;
 
     int _block_size;
     uint64_t _memory_size;
@@ -313,6 +358,8 @@ private:
     void _process();
     void _write_next(uint8_t *data, uint32_t size);
     void _read_next();
+    int _cache_flush();
+    uint8_t *_cache_load(uint64_t lba, uint64_t count);
 
     void CBWDecode(uint8_t *buf, uint16_t size);
     void sendCSW(void);
@@ -326,8 +373,10 @@ private:
     bool modeSense10(void);
     void testUnitReady(void);
     bool requestSense(void);
+    bool mediumCheck(void);
     void memoryVerify(uint8_t *buf, uint16_t size);
     void memoryWrite(uint8_t *buf, uint16_t size);
+    void synchronizeCache(void);
     void msd_reset();
     void fail();
 };
@@ -50,6 +50,7 @@ using namespace arduino;
 #define WRITE12                    0xAA
 #define MODE_SELECT10              0x55
 #define MODE_SENSE10               0x5A
+#define SYNCHRONIZE_CACHE10        0x35
 
 // MSC class specific requests
 #define MSC_REQUEST_RESET          0xFF
@@ -69,14 +70,16 @@ enum Status {
 
 USBMSD::USBMSD(mbed::BlockDevice *bd, bool connect_blocking, uint16_t vendor_id, uint16_t product_id, uint16_t product_release)
     : arduino::internal::PluggableUSBModule(1), _in_task(&_queue), _out_task(&_queue),
-      _initialized(false), _media_removed(false), _bd(bd)
+      _initialized(false), _media_removed(false), _ejected(false), _media_changed(false),
+      _sense_key(0x05), _sense_asc(0x30), _bd(bd)
 {
     PluggableUSBD().plug(this);
 }
 
 USBMSD::USBMSD(USBPhy *phy, mbed::BlockDevice *bd, uint16_t vendor_id, uint16_t product_id, uint16_t product_release)
     : arduino::internal::PluggableUSBModule(1), _in_task(&_queue), _out_task(&_queue),
-      _initialized(false), _media_removed(false), _bd(bd)
+      _initialized(false), _media_removed(false), _ejected(false), _media_changed(false),
+      _sense_key(0x05), _sense_asc(0x30), _bd(bd)
 {
     PluggableUSBD().plug(this);
 }
@@ -99,7 +102,8 @@ void USBMSD::init(EndpointResolver& resolver)
     _stage = READ_CBW;
     memset((void *)&_cbw, 0, sizeof(CBW));
     memset((void *)&_csw, 0, sizeof(CSW));
-    _page = NULL;
+    _cache = NULL;
+    _cache_dirty = false;
     connect();
 
     _t.start(mbed::callback(this, &USBMSD::process));
@@ -142,9 +146,14 @@ bool USBMSD::connect()
     if (_block_count > 0) {
         _block_size = _memory_size / _block_count;
         if (_block_size != 0) {
-            free(_page);
-            _page = (uint8_t *)malloc(_block_size * sizeof(uint8_t));
-            if (_page == NULL) {
+            free(_cache);
+            _cache_sectors = USBMSD_CACHE_SECTORS;
+            _cache = (uint8_t *)malloc(_cache_sectors * _block_size * sizeof(uint8_t));
+            while (_cache == NULL && _cache_sectors > 1) {
+                _cache_sectors /= 2;
+                _cache = (uint8_t *)malloc(_cache_sectors * _block_size * sizeof(uint8_t));
+            }
+            if (_cache == NULL) {
                 //_mutex.unlock();
                 //_mutex_init.unlock();
                 return false;
@@ -156,6 +165,11 @@ bool USBMSD::connect()
         return false;
     }
 
+    _cache_count = 0;
+    _cache_dirty = false;
+    _cache_error = false;
+    _read_lba = 0;
+
     //connect the device
     //USBDevice::connect();
     _initialized = true;
@@ -173,9 +187,14 @@ void USBMSD::disconnect()
     //USBDevice::disconnect();
     _initialized = false;
 
-    //De-allocate MSD page size:
-    free(_page);
-    _page = NULL;
+    //Write back and de-allocate the sector cache:
+    _mutex.lock();
+    if (_cache != NULL) {
+        _cache_flush();
+    }
+    free(_cache);
+    _cache = NULL;
+    _mutex.unlock();
 
     //_mutex.unlock();
     //_mutex_init.unlock();
@@ -185,7 +204,16 @@ void USBMSD::process()
 {
     while (1) {
         if (_initialized) {
-            _data_available.wait_any(0xFF, 10);
+            uint32_t flags = _data_available.wait_any(0xFF, 10);
+            if (flags & osFlagsError) {
+                // the host has gone quiet between commands, write back what
+                // it left behind
+                _mutex.lock();
+                if (_stage != PROCESS_CBW) {
+                    _cache_flush();
+                }
+                _mutex.unlock();
+            }
             _queue.dispatch();
             //yield();
         }
@@ -201,6 +229,31 @@ bool USBMSD::media_removed()
     return _media_removed;
 }
 
+bool USBMSD::eject()
+{
+    for (int i = 0; i < 100; i++) {
+        _mutex.lock();
+        if (_stage != PROCESS_CBW) {
+            _cache_flush();
+            _cache_count = 0;
+            _ejected = true;
+            _mutex.unlock();
+            return true;
+        }
+        _mutex.unlock();
+        rtos::ThisThread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+void USBMSD::insert()
+{
+    _mutex.lock();
+    _ejected = false;
+    _media_changed = true;
+    _mutex.unlock();
+}
+
 int USBMSD::disk_read(uint8_t *data, uint64_t block, uint8_t count)
 {
     // this operation must be executed in another thread
@@ -214,6 +267,8 @@ int USBMSD::disk_read(uint8_t *data, uint64_t block, uint8_t count)
     return 0;
 }
 
+static_assert(USBMSD_CACHE_SECTORS > 0 && USBMSD_CACHE_SECTORS <= 255, "USBMSD_CACHE_SECTORS must fit disk_write()'s count");
+
 int USBMSD::disk_write(const uint8_t *data, uint64_t block, uint8_t count)
 {
     // this operation must be executed in another thread
@@ -560,15 +615,24 @@ void USBMSD::memoryWrite(uint8_t *buf, uint16_t size)
         endpoint_stall(_bulk_out);
     }
 
-    // we fill an array in RAM of 1 block before writing it in memory
-    for (int i = 0; i < size; i++) {
-        _page[_addr % _block_size + i] = buf[i];
+    uint64_t lba = _addr / _block_size;
+
+    // a sector that does not carry on the dirty run starts a new one, the
+    // old run is written back first
+    if (!(_addr % _block_size) && !(_cache_dirty && lba == _cache_lba + _cache_count)) {
+        _cache_flush();
+        _cache_lba = lba;
+        _cache_count = 0;
+        _cache_dirty = true;
     }
 
-    // if the array is filled, write it in memory
+    memcpy(&_cache[(lba - _cache_lba) * _block_size + _addr % _block_size], buf, size);
+
+    // a complete sector joins the run, a full run is written back at once
     if (!((_addr + size) % _block_size)) {
-        if (!(disk_status() & WRITE_PROTECT)) {
-            disk_write(_page, _addr / _block_size, 1);
+        _cache_count++;
+        if (_cache_count == _cache_sectors) {
+            _cache_flush();
         }
     }
 
@@ -577,11 +641,56 @@ void USBMSD::memoryWrite(uint8_t *buf, uint16_t size)
     _csw.DataResidue -= size;
 
     if ((!_length) || (_stage != PROCESS_CBW)) {
-        _csw.Status = (_stage == ERROR) ? CSW_FAILED : CSW_PASSED;
+        _csw.Status = (_stage == ERROR || _cache_error) ? CSW_FAILED : CSW_PASSED;
+        _cache_error = false;
         sendCSW();
     }
 }
 
+// Writes the dirty run back in one erase and program, the sectors stay in
+// the cache for reads
+int USBMSD::_cache_flush()
+{
+    int ret = 0;
+
+    if (_cache_dirty && _cache_count && !(disk_status() & WRITE_PROTECT)) {
+        ret = disk_write(_cache, _cache_lba, _cache_count);
+    }
+    if (ret != 0) {
+        _cache_count = 0;
+        _cache_error = true;
+    }
+    _cache_dirty = false;
+    return ret;
+}
+
+// Returns sector lba in RAM; on a miss up to count sectors from lba are read
+// in with it
+uint8_t *USBMSD::_cache_load(uint64_t lba, uint64_t count)
+{
+    if (!_cache_count || lba < _cache_lba || lba >= _cache_lba + _cache_count) {
+        _cache_flush();
+
+        uint64_t left = (lba < _block_count) ? _block_count - lba : 1;
+        count = (count > _cache_sectors) ? _cache_sectors : count;
+        count = (count > left) ? left : count;
+        count = count ? count : 1;
+
+        disk_read(_cache, lba, (uint8_t)count);
+        _cache_lba = lba;
+        _cache_count = count;
+    }
+    return &_cache[(lba - _cache_lba) * _block_size];
+}
+
+void USBMSD::synchronizeCache(void)
+{
+    _cache_flush();
+    _csw.Status = _cache_error ? CSW_FAILED : CSW_PASSED;
+    _cache_error = false;
+    sendCSW();
+}
+
 void USBMSD::memoryVerify(uint8_t *buf, uint16_t size)
 {
     uint32_t n;
@@ -592,14 +701,12 @@ void USBMSD::memoryVerify(uint8_t *buf, uint16_t size)
         endpoint_stall(_bulk_out);
     }
 
-    // beginning of a new block -> load a whole block in RAM
-    if (!(_addr % _block_size)) {
-        disk_read(_page, _addr / _block_size, 1);
-    }
+    // the rest of the command is loaded in RAM as far as the cache goes
+    uint8_t *sector = _cache_load(_addr / _block_size, (_length + _block_size - 1) / _block_size);
 
     // info are in RAM -> no need to re-read memory
     for (n = 0; n < size; n++) {
-        if (_page[_addr % _block_size + n] != buf[n]) {
+        if (sector[_addr % _block_size + n] != buf[n]) {
             _mem_ok = false;
             break;
         }
@@ -716,7 +823,7 @@ bool USBMSD::requestSense(void)
     uint8_t request_sense[] = {
         0x70,
         0x00,
-        0x05,   // Sense Key: illegal request
+        _sense_key,
         0x00,
         0x00,
         0x00,
@@ -726,7 +833,7 @@ bool USBMSD::requestSense(void)
         0x00,
         0x00,
         0x00,
-        0x30,
+        _sense_asc,
         0x01,
         0x00,
         0x00,
@@ -734,6 +841,10 @@ bool USBMSD::requestSense(void)
         0x00,
     };
 
+    // back to the default, illegal request
+    _sense_key = 0x05;
+    _sense_asc = 0x30;
+
     if (!write(request_sense, sizeof(request_sense))) {
         return false;
     }
@@ -741,6 +852,37 @@ bool USBMSD::requestSense(void)
     return true;
 }
 
+// Fails commands that need the medium while it is ejected, and the first
+// one after it came back, with the reason left for REQUEST_SENSE
+bool USBMSD::mediumCheck(void)
+{
+    if (_cbw.CB[0] == INQUIRY || _cbw.CB[0] == REQUEST_SENSE) {
+        return true;
+    }
+    if (_ejected) {
+        // not ready, medium not present
+        _sense_key = 0x02;
+        _sense_asc = 0x3A;
+    } else if (_media_changed) {
+        // unit attention, medium may have changed
+        _media_changed = false;
+        _sense_key = 0x06;
+        _sense_asc = 0x28;
+    } else {
+        return true;
+    }
+
+    if (_cbw.DataLength != 0) {
+        if ((_cbw.Flags & 0x80) != 0) {
+            endpoint_stall(_bulk_in);
+        } else {
+            endpoint_stall(_bulk_out);
+        }
+    }
+    fail();
+    return false;
+}
+
 void USBMSD::fail()
 {
     _csw.Status = CSW_FAILED;
@@ -757,7 +899,7 @@ void USBMSD::CBWDecode(uint8_t *buf, uint16_t size)
             _csw.DataResidue = _cbw.DataLength;
             if ((_cbw.CBLength <  1) || (_cbw.CBLength > 16)) {
                 fail();
-            } else {
+            } else if (mediumCheck()) {
                 switch (_cbw.CB[0]) {
                     case TEST_UNIT_READY:
                         testUnitReady();
@@ -819,7 +961,11 @@ void USBMSD::CBWDecode(uint8_t *buf, uint16_t size)
                             }
                         }
                         break;
+                    case SYNCHRONIZE_CACHE10:
+                        synchronizeCache();
+                        break;
                     case MEDIA_REMOVAL:
+                        _cache_flush();
                         _csw.Status = CSW_PASSED;
                         sendCSW();
                         _media_removed = true;
@@ -863,13 +1009,14 @@ void USBMSD::memoryRead(void)
         _stage = ERROR;
     }
 
-    // we read an entire block
-    if (!(_addr % _block_size)) {
-        disk_read(_page, _addr / _block_size, 1);
-    }
+    // a command that carries on from the last one is read ahead a whole
+    // cache at a time, any other only as far as it goes
+    uint64_t lba = _addr / _block_size;
+    uint64_t count = (lba == _read_lba) ? _cache_sectors : (_length + _block_size - 1) / _block_size;
+    uint8_t *sector = _cache_load(lba, count);
 
     // write data which are in RAM
-    _write_next(&_page[_addr % _block_size], MAX_PACKET);
+    _write_next(&sector[_addr % _block_size], MAX_PACKET);
 
     _addr += n;
     _length -= n;
@@ -877,6 +1024,7 @@ void USBMSD::memoryRead(void)
     _csw.DataResidue -= n;
 
     if (!_length || (_stage != PROCESS_CBW)) {
+        _read_lba = _addr / _block_size;
         _csw.Status = (_stage == PROCESS_CBW) ? CSW_PASSED : CSW_FAILED;
         _stage = (_stage == PROCESS_CBW) ? SEND_CSW : _stage;
     }
@@ -23,9 +23,32 @@
 #include "Wire.h"
 #include "pinDefinitions.h"
 
-arduino::MbedI2C::MbedI2C(int sda, int scl) : _sda(digitalPinToPinName(sda)), _scl(digitalPinToPinName(scl)), usedTxBuffer(0), slave_th(osPriorityNormal, 2048, nullptr, "I2CSlave") {}
+typedef struct _i2c_transaction {
+	int address;
+	const uint8_t* tx;
+	size_t txlen;
+	uint8_t* rx;
+	size_t rxlen;
+	mbed::Callback<void(int)> callback;
+} i2c_transaction_t;
 
-arduino::MbedI2C::MbedI2C(PinName sda, PinName scl) : _sda(sda), _scl(scl), usedTxBuffer(0), slave_th(osPriorityNormal, 2048, nullptr, "I2CSlave") {}
+// transferAsync() state, only allocated on first use
+struct _mbed_i2c_async {
+	rtos::Mail<i2c_transaction_t, WIRE_ASYNC_QUEUE_SIZE> queue;
+	rtos::Thread thread;
+	rtos::Semaphore done;
+	volatile int event;
+	// set by end(), no new transfers are taken after it
+	volatile bool stopping;
+	// queued or in flight, end() waits for this to drop to 0
+	std::atomic<int> pending;
+
+	_mbed_i2c_async() : thread(osPriorityAboveNormal, 2048, nullptr, "WireAsync"), event(0), stopping(false), pending(0) {}
+};
+
+arduino::MbedI2C::MbedI2C(int sda, int scl) : _sda(digitalPinToPinName(sda)), _scl(digitalPinToPinName(scl)), usedTxBuffer(0) {}
+
+arduino::MbedI2C::MbedI2C(PinName sda, PinName scl) : _sda(sda), _scl(scl), usedTxBuffer(0) {}
 
 void arduino::MbedI2C::begin() {
 	master = new mbed::I2C(_sda, _scl);
@@ -33,19 +56,42 @@ void arduino::MbedI2C::begin() {
 
 void arduino::MbedI2C::begin(uint8_t slaveAddr) {
 #ifdef DEVICE_I2CSLAVE
-	slave = new mbed::I2CSlave((PinName)_sda, (PinName)_scl);
+	if (slave == NULL) {
+		slave = new mbed::I2CSlave((PinName)_sda, (PinName)_scl);
+	}
 	slave->address(slaveAddr << 1);
-	slave_th.start(mbed::callback(this, &arduino::MbedI2C::receiveThd));
+	if (slave_th == NULL) {
+		slave_th = new rtos::Thread(osPriorityNormal, 2048, nullptr, "I2CSlave");
+		slave_th->start(mbed::callback(this, &arduino::MbedI2C::receiveThd));
+	}
 #endif
 }
 
 void arduino::MbedI2C::end() {
+	if (async != NULL) {
+		// let the queue drain, the worker owns the callbacks and a transfer in
+		// flight still has the completion interrupt to come
+		async->stopping = true;
+		while (async->pending > 0) {
+			rtos::ThisThread::sleep_for(std::chrono::milliseconds(1));
+		}
+		async->thread.terminate();
+		delete async;
+		async = NULL;
+	}
 	if (master != NULL) {
 		delete master;
+		master = NULL;
 	}
 #ifdef DEVICE_I2CSLAVE
+	if (slave_th != NULL) {
+		slave_th->terminate();
+		delete slave_th;
+		slave_th = NULL;
+	}
 	if (slave != NULL) {
 		delete slave;
+		slave = NULL;
 	}
 #endif
 }
@@ -84,21 +130,107 @@ uint8_t arduino::MbedI2C::endTransmission(void) {
 }
 
 size_t arduino::MbedI2C::requestFrom(uint8_t address, size_t len, bool stopBit) {
+	uint8_t* span;
+	// read straight into rxBuffer when there is enough contiguous room
+	if (rxBuffer.write_span(span) >= len) {
+		if (master->read(address << 1, (char*)span, len, !stopBit) != 0) {
+			return 0;
+		}
+		rxBuffer.commit_write(len);
+		return len;
+	}
 	char buf[256];
+	if (len > sizeof(buf)) {
+		len = sizeof(buf);
+	}
 	int ret = master->read(address << 1, buf, len, !stopBit);
 	if (ret != 0) {
 		return 0;
 	}
-	for (size_t i=0; i<len; i++) {
-		rxBuffer.store_char(buf[i]);
-	}
-	return len;
+	return rxBuffer.write((uint8_t*)buf, len);
 }
 
 size_t arduino::MbedI2C::requestFrom(uint8_t address, size_t len) {
 	return requestFrom(address, len, true);
 }
 
+int arduino::MbedI2C::transferAsync(uint8_t address, const uint8_t* tx, size_t txlen, uint8_t* rx, size_t rxlen,
+                                    mbed::Callback<void(int)> callback) {
+	if (master == NULL) {
+		return -1;
+	}
+	if (async == NULL) {
+		if (core_util_is_isr_active()) {
+			return -1;
+		}
+		master->lock();
+		if (async == NULL) {
+			async = new mbed_i2c_async;
+			async->thread.start(mbed::callback(this, &arduino::MbedI2C::asyncThd));
+		}
+		master->unlock();
+	}
+	if (async->stopping) {
+		return -1;
+	}
+	i2c_transaction_t* txn = async->queue.try_alloc();
+	if (txn == NULL) {
+		return -1;
+	}
+	new (txn) i2c_transaction_t{address << 1, tx, txlen, rx, rxlen, callback};
+	async->pending++;
+	async->queue.put(txn);
+	return 0;
+}
+
+void arduino::MbedI2C::onAsyncEvent(int event) {
+	async->event = event;
+	async->done.release();
+}
+
+void arduino::MbedI2C::asyncThd() {
+	while (1) {
+		i2c_transaction_t* txn = async->queue.try_get_for(rtos::Kernel::wait_for_u32_forever);
+		if (txn == NULL) {
+			continue;
+		}
+
+		// hold the bus so that blocking calls from other threads wait
+		master->lock();
+		int event;
+#if DEVICE_I2C_ASYNCH
+		if (master->transfer(txn->address, (const char*)txn->tx, txn->txlen, (char*)txn->rx, txn->rxlen,
+		                     mbed::callback(this, &arduino::MbedI2C::onAsyncEvent), I2C_EVENT_ALL) == 0) {
+			if (async->done.try_acquire_for(std::chrono::milliseconds(WIRE_ASYNC_TIMEOUT_MS))) {
+				event = async->event;
+			} else {
+				master->abort_transfer();
+				event = I2C_EVENT_ERROR;
+			}
+		} else {
+			event = I2C_EVENT_ERROR;
+		}
+#else
+		int ret = 0;
+		if (txn->txlen > 0) {
+			ret = master->write(txn->address, (const char*)txn->tx, txn->txlen, txn->rxlen > 0);
+		}
+		if (ret == 0 && txn->rxlen > 0) {
+			ret = master->read(txn->address, (char*)txn->rx, txn->rxlen);
+		}
+		event = ret == 0 ? I2C_EVENT_TRANSFER_COMPLETE : I2C_EVENT_ERROR;
+#endif
+		master->unlock();
+
+		if (txn->callback) {
+			txn->callback(event);
+		}
+		txn->~i2c_transaction_t();
+		async->queue.free(txn);
+		async->pending--;
+	}
+}
+
 size_t arduino::MbedI2C::write(uint8_t data) {
 	if (usedTxBuffer == 256) return 0;
 	txBuffer[usedTxBuffer++] = data;
@@ -112,7 +244,13 @@ size_t arduino::MbedI2C::write(const uint8_t* data, int len) {
 	return len;
 }
 
+// Runs on the reading side, which is the only one allowed to move the tail
+void arduino::MbedI2C::skipStale() {
+	rxBuffer.skip_to(rxStart);
+}
+
 int arduino::MbedI2C::read() {
+	skipStale();
 	if (rxBuffer.available()) {
 		return rxBuffer.read_char();
 	}
@@ -120,10 +258,12 @@ int arduino::MbedI2C::read() {
 }
 
 int arduino::MbedI2C::available() {
+	skipStale();
 	return rxBuffer.available();
 }
 
 int arduino::MbedI2C::peek() {
+	skipStale();
 	return rxBuffer.peek();
 }
 
@@ -132,10 +272,15 @@ void arduino::MbedI2C::flush() {
 
 #ifdef DEVICE_I2CSLAVE
 void arduino::MbedI2C::receiveThd() {
+	// mbed's I2CSlave has no address match event to wait on, so back off
+	// while the bus is idle instead of spinning
+	uint32_t idle_ms = 0;
 	while (1) {
 		int i = slave->receive();
 		int c = 0;
-		int buf_idx = 0;
+		if (i != mbed::I2CSlave::NoData) {
+			idle_ms = 0;
+		}
 		switch (i) {
 			case mbed::I2CSlave::ReadAddressed:
 				if (onRequestCb != NULL) {
@@ -149,24 +294,39 @@ void arduino::MbedI2C::receiveThd() {
 				break;
 			case mbed::I2CSlave::WriteGeneral:
 			case mbed::I2CSlave::WriteAddressed:
-				rxBuffer.clear();
-				char buf[240];
-				c = slave->read(buf, sizeof(buf));
-				for (buf_idx = 0; buf_idx < c; buf_idx++) {
-					if (rxBuffer.availableForStore()) {
-						rxBuffer.store_char(uint8_t(buf[buf_idx]));
-					} else {
-						break;
+				// a new write replaces what the sketch has not read of the last one
+				rxStart = rxBuffer.write_position();
+				uint8_t* span;
+				// receive straight into rxBuffer when the free room is contiguous
+				if (rxBuffer.write_span(span) >= 240) {
+					c = slave->read((char*)span, 240);
+					if (c > 0) {
+						rxBuffer.commit_write(c);
+					}
+				} else {
+					char buf[240];
+					c = slave->read(buf, sizeof(buf));
+					if (c > 0) {
+						rxBuffer.write((uint8_t*)buf, c);
 					}
 				}
-				if (rxBuffer.available() > 0 && onReceiveCb != NULL) {
-					onReceiveCb(rxBuffer.available());
+				// only the reader may skip stale data, so count this write here
+				size_t n = rxBuffer.write_position() - rxStart;
+				if (n > 0 && onReceiveCb != NULL) {
+					onReceiveCb(n);
 				}
 				//slave->stop();
 				break;
 		case mbed::I2CSlave::NoData:
 			//slave->stop();
-			yield();
+			if (idle_ms == 0) {
+				yield();
+			} else {
+				rtos::ThisThread::sleep_for(std::chrono::milliseconds(idle_ms));
+			}
+			if (idle_ms < WIRE_SLAVE_POLL_MAX_MS) {
+				idle_ms++;
+			}
 			break;
 		}
 	}
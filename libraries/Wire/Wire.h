@@ -26,9 +26,27 @@
 #include "drivers/I2CSlave.h"
 #endif
 #include "rtos.h"
+#include "SPSCRingBuffer.h"
 
 typedef void (*voidFuncPtrParamInt)(int);
 
+// Longest sleep between two polls of an idle I2C slave, in ms
+#ifndef WIRE_SLAVE_POLL_MAX_MS
+#define WIRE_SLAVE_POLL_MAX_MS 8
+#endif
+
+// Depth of the transferAsync() queue
+#ifndef WIRE_ASYNC_QUEUE_SIZE
+#define WIRE_ASYNC_QUEUE_SIZE 16
+#endif
+
+// Longest an asynchronous transfer may take before it is aborted, in ms
+#ifndef WIRE_ASYNC_TIMEOUT_MS
+#define WIRE_ASYNC_TIMEOUT_MS 1000
+#endif
+
+typedef struct _mbed_i2c_async mbed_i2c_async;
+
 namespace arduino {
 
 class MbedI2C : public HardwareI2C
@@ -53,6 +71,16 @@ class MbedI2C : public HardwareI2C
     virtual size_t requestFrom(uint8_t address, size_t len, bool stopBit);
     virtual size_t requestFrom(uint8_t address, size_t len);
 
+    // Queues a write of txlen bytes followed, after a repeated start, by a
+    // read of rxlen bytes; either length may be 0. The transaction runs in
+    // the background, interrupt driven where the target supports
+    // asynchronous I2C, and the buffers must stay valid until callback gets
+    // the I2C_EVENT_* mask on the Wire worker thread. Returns -1 when the
+    // queue is full. Can be called from an interrupt once a first call from
+    // a thread has started the worker
+    int transferAsync(uint8_t address, const uint8_t* tx, size_t txlen, uint8_t* rx, size_t rxlen,
+                      mbed::Callback<void(int)> callback = nullptr);
+
     virtual void onReceive(void(*)(int));
     virtual void onRequest(void(*)(void));
 
@@ -68,6 +96,8 @@ class MbedI2C : public HardwareI2C
     virtual int available();
 
 private:
+    void asyncThd();
+    void onAsyncEvent(int event);
 
 #ifdef DEVICE_I2CSLAVE
     mbed::I2CSlave* slave = NULL;
@@ -76,13 +106,18 @@ private:
     PinName _sda;
     PinName _scl;
     int _address;
-    RingBufferN<256> rxBuffer;
+    SPSCRingBufferN<256> rxBuffer;
+    // start of the newest slave write; the reader drops what came before it
+    volatile size_t rxStart = 0;
+    void skipStale();
     uint8_t txBuffer[256];
     uint32_t usedTxBuffer;
     voidFuncPtrParamInt onReceiveCb = NULL;
     voidFuncPtr onRequestCb = NULL;
+    mbed_i2c_async* async = NULL;
 #ifdef DEVICE_I2CSLAVE
-    rtos::Thread slave_th;
+    // only created by begin(address)
+    rtos::Thread* slave_th = NULL;
     void receiveThd();
 #endif
 };
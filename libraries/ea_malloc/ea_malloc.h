@@ -39,6 +39,15 @@ void malloc_init(void);
 void* ea_malloc(size_t size);
 void ea_free(void* ptr);
 
+/**
+* @brief Usable size of a block returned by ea_malloc()
+*
+* At least the size that was asked for, rounded up to the allocator's granularity.
+*
+* @param ptr Pointer returned by ea_malloc()
+*/
+size_t ea_malloc_usable_size(void* ptr);
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
@@ -3,9 +3,9 @@
  * License: MIT. See LICENSE file for details.
  */
 
-#include <ll.h>
 #include <ea_malloc.h>
 #include <memory.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #pragma mark - Definitions -
@@ -19,63 +19,264 @@
 #endif
 
 /*
- * This is the container for our free-list.
- * Node the usage of the linked list here: the library uses offsetof
- * and container_of to manage the list and get back to the parent struct.
+ * Free blocks are kept on segregated lists in the style of TLSF: a first
+ * level per power of two of the size, split into SL_INDEX_COUNT linear
+ * second level classes. Two bitmaps tell which lists are non empty, so both
+ * malloc and free are a handful of bit scans instead of list walks.
  */
-typedef struct
+#define ALIGN_SIZE_LOG2 3
+#define ALIGN_SIZE (1 << ALIGN_SIZE_LOG2)
+
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+
+// Sizes below SMALL_BLOCK_SIZE all share first level 0
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define SMALL_BLOCK_SIZE (1 << FL_INDEX_SHIFT)
+
+// Largest block is 2^EA_MALLOC_FL_INDEX_MAX, bigger areas are added in pieces
+#ifndef EA_MALLOC_FL_INDEX_MAX
+#define EA_MALLOC_FL_INDEX_MAX 25
+#endif
+#define FL_INDEX_COUNT (EA_MALLOC_FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define BLOCK_SIZE_MAX (((size_t)1 << EA_MALLOC_FL_INDEX_MAX) - ALIGN_SIZE)
+
+/*
+ * Every block starts with a boundary tag. prev_phys is only valid while the
+ * physically previous block is free, which is what lets free() coalesce with
+ * both neighbours in constant time. next_free/prev_free live in the payload
+ * and are only used while the block itself is free.
+ */
+typedef struct block_header
 {
-	ll_t node;
+	struct block_header* prev_phys;
 	size_t size;
-	char* block;
-} alloc_node_t;
+	struct block_header* next_free;
+	struct block_header* prev_free;
+} block_t;
+
+// Low bits of size, which is always a multiple of ALIGN_SIZE
+#define BLOCK_FREE (1 << 0)
+#define BLOCK_PREV_FREE (1 << 1)
+#define BLOCK_FLAGS (BLOCK_FREE | BLOCK_PREV_FREE)
 
 /**
  * We vend a memory address to the user.  This lets us translate back and forth
- * between the vended pointer and the container we use for managing the data.
+ * between the vended pointer and the boundary tag in front of it.
  */
-#define ALLOC_HEADER_SZ offsetof(alloc_node_t, block)
+#define ALLOC_HEADER_SZ align_up(offsetof(block_t, next_free), ALIGN_SIZE)
 
-// We are enforcing a minimum allocation size of 32B.
-#define MIN_ALLOC_SZ ALLOC_HEADER_SZ + 32
-
-#pragma mark - Prototypes -
-
-static void defrag_free_list(void);
+// A free block must have room for its list links, and splits smaller than
+// this are not worth it
+#define MIN_ALLOC_SZ 32
 
 #pragma mark - Declarations -
 
-// This macro simply declares and initializes our linked list
-static LIST_INIT(free_list);
+static unsigned int fl_bitmap;
+static unsigned int sl_bitmap[FL_INDEX_COUNT];
+static block_t* free_blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
 
 #pragma mark - Private Functions -
 
+static inline int tlsf_fls(size_t x)
+{
+	return x ? (int)(sizeof(unsigned long) * 8) - 1 - __builtin_clzl(x) : -1;
+}
+
+static inline int tlsf_ffs(unsigned int x)
+{
+	return x ? __builtin_ctz(x) : -1;
+}
+
+static inline size_t block_size(const block_t* blk)
+{
+	return blk->size & ~(size_t)BLOCK_FLAGS;
+}
+
+static inline void block_set_size(block_t* blk, size_t size)
+{
+	blk->size = size | (blk->size & BLOCK_FLAGS);
+}
+
+static inline void* block_to_ptr(const block_t* blk)
+{
+	return (void*)((uintptr_t)blk + ALLOC_HEADER_SZ);
+}
+
+static inline block_t* block_from_ptr(const void* ptr)
+{
+	return (block_t*)((uintptr_t)ptr - ALLOC_HEADER_SZ);
+}
+
+static inline block_t* block_next(const block_t* blk)
+{
+	return (block_t*)((uintptr_t)block_to_ptr(blk) + block_size(blk));
+}
+
 /**
- * When we free, we can take our node and check to see if any memory blocks
- * can be combined into larger blocks.  This will help us fight against
- * memory fragmentation in a simple way.
+ * Flags blk as free and tells the block after it where its free
+ * neighbour starts.
  */
-void defrag_free_list(void)
+static inline void block_mark_free(block_t* blk)
 {
-	alloc_node_t* b;
-	alloc_node_t* lb = NULL;
-	alloc_node_t* t;
+	block_t* next = block_next(blk);
+	blk->size |= BLOCK_FREE;
+	next->prev_phys = blk;
+	next->size |= BLOCK_PREV_FREE;
+}
+
+static inline void block_mark_used(block_t* blk)
+{
+	blk->size &= ~(size_t)BLOCK_FREE;
+	block_next(blk)->size &= ~(size_t)BLOCK_PREV_FREE;
+}
+
+/**
+ * Lists that hold blocks of exactly this size class.
+ */
+static void mapping_insert(size_t size, int* fl, int* sl)
+{
+	if(size < SMALL_BLOCK_SIZE)
+	{
+		*fl = 0;
+		*sl = (int)(size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT));
+	}
+	else
+	{
+		int f = tlsf_fls(size);
+		*sl = (int)(size >> (f - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+		*fl = f - (FL_INDEX_SHIFT - 1);
+	}
+}
+
+/**
+ * First list whose blocks are all at least size bytes, so that any block
+ * taken from it fits without looking at the others.
+ */
+static void mapping_search(size_t size, int* fl, int* sl)
+{
+	if(size >= SMALL_BLOCK_SIZE)
+	{
+		size += ((size_t)1 << (tlsf_fls(size) - SL_INDEX_COUNT_LOG2)) - 1;
+	}
+	mapping_insert(size, fl, sl);
+}
 
-	list_for_each_entry_safe(b, t, &free_list, node)
+static block_t* search_suitable_block(int* fl, int* sl)
+{
+	if(*fl >= FL_INDEX_COUNT)
 	{
-		if(lb)
+		return NULL;
+	}
+
+	unsigned int sl_map = sl_bitmap[*fl] & (~0U << *sl);
+	if(!sl_map)
+	{
+		unsigned int fl_map = (*fl + 1 < FL_INDEX_COUNT) ? fl_bitmap & (~0U << (*fl + 1)) : 0;
+		if(!fl_map)
 		{
-			if((((uintptr_t)&lb->block) + lb->size) == (uintptr_t)b)
+			return NULL;
+		}
+		*fl = tlsf_ffs(fl_map);
+		sl_map = sl_bitmap[*fl];
+	}
+	*sl = tlsf_ffs(sl_map);
+
+	return free_blocks[*fl][*sl];
+}
+
+static void remove_free_block(block_t* blk, int fl, int sl)
+{
+	if(blk->prev_free)
+	{
+		blk->prev_free->next_free = blk->next_free;
+	}
+	if(blk->next_free)
+	{
+		blk->next_free->prev_free = blk->prev_free;
+	}
+
+	if(free_blocks[fl][sl] == blk)
+	{
+		free_blocks[fl][sl] = blk->next_free;
+		if(!free_blocks[fl][sl])
+		{
+			sl_bitmap[fl] &= ~(1U << sl);
+			if(!sl_bitmap[fl])
 			{
-				lb->size += sizeof(*b) + b->size;
-				list_del(&b->node);
-				continue;
+				fl_bitmap &= ~(1U << fl);
 			}
 		}
-		lb = b;
 	}
 }
 
+static void insert_free_block(block_t* blk)
+{
+	int fl, sl;
+	mapping_insert(block_size(blk), &fl, &sl);
+
+	blk->prev_free = NULL;
+	blk->next_free = free_blocks[fl][sl];
+	if(blk->next_free)
+	{
+		blk->next_free->prev_free = blk;
+	}
+	free_blocks[fl][sl] = blk;
+	fl_bitmap |= 1U << fl;
+	sl_bitmap[fl] |= 1U << sl;
+}
+
+static void block_remove(block_t* blk)
+{
+	int fl, sl;
+	mapping_insert(block_size(blk), &fl, &sl);
+	remove_free_block(blk, fl, sl);
+}
+
+/**
+ * Gives the tail of blk beyond size back to the free lists, when it is big
+ * enough to be a block of its own.
+ */
+static void block_trim(block_t* blk, size_t size)
+{
+	if(block_size(blk) < size + ALLOC_HEADER_SZ + MIN_ALLOC_SZ)
+	{
+		return;
+	}
+
+	block_t* rest = (block_t*)((uintptr_t)block_to_ptr(blk) + size);
+	rest->size = block_size(blk) - size - ALLOC_HEADER_SZ;
+	block_set_size(blk, size);
+
+	// blk is about to be handed out, so rest has a used neighbour before it
+	block_mark_free(rest);
+	insert_free_block(rest);
+}
+
+/**
+ * Merges blk into its free physical neighbours, which are taken off their
+ * lists, and returns the start of the combined block.
+ */
+static block_t* block_coalesce(block_t* blk)
+{
+	if(blk->size & BLOCK_PREV_FREE)
+	{
+		block_t* prev = blk->prev_phys;
+		block_remove(prev);
+		block_set_size(prev, block_size(prev) + ALLOC_HEADER_SZ + block_size(blk));
+		blk = prev;
+	}
+
+	block_t* next = block_next(blk);
+	if(next->size & BLOCK_FREE)
+	{
+		block_remove(next);
+		block_set_size(blk, block_size(blk) + ALLOC_HEADER_SZ + block_size(next));
+	}
+
+	return blk;
+}
+
 #pragma mark - APIs -
 
 __attribute__((weak)) void malloc_init(void)
@@ -86,83 +287,80 @@ __attribute__((weak)) void malloc_init(void)
 
 void* ea_malloc(size_t size)
 {
-	void* ptr = NULL;
-	alloc_node_t* blk = NULL;
+	int fl, sl;
+	block_t* blk;
 
-	if(size > 0)
+	if(size == 0 || size > BLOCK_SIZE_MAX)
 	{
-		// Align the pointer
-		size = align_up(size, sizeof(void*));
+		return NULL;
+	}
 
-		// try to find a big enough block to alloc
-		list_for_each_entry(blk, &free_list, node)
+	size = align_up(size, ALIGN_SIZE);
+	if(size < MIN_ALLOC_SZ)
+	{
+		size = MIN_ALLOC_SZ;
+	}
+
+	mapping_search(size, &fl, &sl);
+	blk = search_suitable_block(&fl, &sl);
+	if(!blk)
+	{
+		// Nothing in the classes that always fit: the last chance is a block
+		// of size's own class that happens to be big enough, e.g. for a single
+		// buffer covering most of the heap
+		mapping_insert(size, &fl, &sl);
+		for(blk = free_blocks[fl][sl]; blk && block_size(blk) < size; blk = blk->next_free)
 		{
-			if(blk->size >= size)
-			{
-				ptr = &blk->block;
-				break;
-			}
 		}
-
-		// we found something
-		if(ptr)
+		if(!blk)
 		{
-			// Can we split the block?
-			if((blk->size - size) >= MIN_ALLOC_SZ)
-			{
-				alloc_node_t* new_blk;
-				new_blk = (alloc_node_t*)((uintptr_t)(&blk->block) + size);
-				new_blk->size = blk->size - size - ALLOC_HEADER_SZ;
-				blk->size = size;
-				list_insert(&new_blk->node, &blk->node, blk->node.next);
-			}
-
-			list_del(&blk->node);
+			return NULL;
 		}
+	}
 
-	} // else NULL
+	remove_free_block(blk, fl, sl);
+	block_trim(blk, size);
+	block_mark_used(blk);
 
-	return ptr;
+	return block_to_ptr(blk);
 }
 
 void ea_free(void* ptr)
 {
-	alloc_node_t* free_blk;
-	alloc_node_t* blk;
-
 	// Don't free a NULL pointer..
 	if(ptr)
 	{
-		// we take the pointer and use container_of to get the corresponding alloc block
-		blk = container_of(ptr, alloc_node_t, block);
-
-		// Let's put it back in the proper spot
-		list_for_each_entry(free_blk, &free_list, node)
-		{
-			if(free_blk > blk)
-			{
-				list_insert(&blk->node, free_blk->node.prev, &free_blk->node);
-				goto blockadded;
-			}
-		}
-		list_add_tail(&blk->node, &free_list);
-
-	blockadded:
-		// Let's see if we can combine any memory
-		defrag_free_list();
+		block_t* blk = block_coalesce(block_from_ptr(ptr));
+		block_mark_free(blk);
+		insert_free_block(blk);
 	}
 }
 
+size_t ea_malloc_usable_size(void* ptr)
+{
+	return ptr ? block_size(block_from_ptr(ptr)) : 0;
+}
+
 void malloc_addblock(void* addr, size_t size)
 {
-	alloc_node_t* blk;
+	uintptr_t start = align_up((uintptr_t)addr, ALIGN_SIZE);
+	uintptr_t end = ((uintptr_t)addr + size) & ~(uintptr_t)(ALIGN_SIZE - 1);
 
-	// let's align the start address of our block to the next pointer aligned number
-	blk = (void*)align_up((uintptr_t)addr, sizeof(void*));
+	while(end > start && end - start >= 3 * ALLOC_HEADER_SZ + MIN_ALLOC_SZ)
+	{
+		// one free block followed by a zero sized used block, which stops
+		// coalescing from running off the end of the area
+		size_t avail = end - start - 2 * ALLOC_HEADER_SZ;
+		size_t blk_size = avail > BLOCK_SIZE_MAX ? BLOCK_SIZE_MAX : avail;
+		block_t* blk = (block_t*)start;
+		block_t* sentinel;
 
-	// calculate actual size - remove our alignment and our header space from the availability
-	blk->size = (uintptr_t)addr + size - (uintptr_t)blk - ALLOC_HEADER_SZ;
+		blk->size = blk_size;
+		sentinel = block_next(blk);
+		sentinel->size = 0;
+		block_mark_free(blk);
+		insert_free_block(blk);
 
-	// and now our giant block of memory is added to the list!
-	list_add(&blk->node, &free_list);
+		start = (uintptr_t)sentinel + ALLOC_HEADER_SZ;
+	}
 }
@@ -81,11 +81,24 @@ struct rpmsg_endpoint {
 /**
  * struct rpmsg_device_ops - RPMsg device operations
  * @send_offchannel_raw: send RPMsg data
+ * @hold_rx_buffer: hold RPMsg RX buffer
+ * @release_rx_buffer: release RPMsg RX buffer
+ * @get_tx_payload_buffer: get RPMsg TX buffer
+ * @release_tx_buffer: give back an unsent RPMsg TX buffer
+ * @send_offchannel_nocopy: send RPMsg data without copy
  */
 struct rpmsg_device_ops {
 	int (*send_offchannel_raw)(struct rpmsg_device *rdev,
 				   uint32_t src, uint32_t dst,
 				   const void *data, int size, int wait);
+	void (*hold_rx_buffer)(struct rpmsg_device *rdev, void *rxbuf);
+	void (*release_rx_buffer)(struct rpmsg_device *rdev, void *rxbuf);
+	void *(*get_tx_payload_buffer)(struct rpmsg_device *rdev,
+				       uint32_t *len, int wait);
+	void (*release_tx_buffer)(struct rpmsg_device *rdev, void *txbuf);
+	int (*send_offchannel_nocopy)(struct rpmsg_device *rdev,
+				      uint32_t src, uint32_t dst,
+				      const void *data, int len);
 };
 
 /**
@@ -268,6 +281,88 @@ static inline int rpmsg_trysend_offchannel(struct rpmsg_endpoint *ept,
 	return rpmsg_send_offchannel_raw(ept, src, dst, data, len, false);
 }
 
+/**
+ * rpmsg_hold_rx_buffer() - Hold the rx buffer for usage outside the callback.
+ * @ept: the rpmsg endpoint
+ * @rxbuf: RX buffer with message payload
+ *
+ * This API must be called in the rpmsg endpoint callback. The buffer is not
+ * returned to the virtqueue when the callback returns, so the payload can be
+ * parsed in place by another thread. rpmsg_release_rx_buffer() must be
+ * called once the payload has been consumed.
+ */
+void rpmsg_hold_rx_buffer(struct rpmsg_endpoint *ept, void *rxbuf);
+
+/**
+ * rpmsg_release_rx_buffer() - Release a held rx buffer.
+ * @ept: the rpmsg endpoint
+ * @rxbuf: RX buffer with message payload
+ *
+ * This API returns a buffer previously held by rpmsg_hold_rx_buffer()
+ * to the virtqueue.
+ */
+void rpmsg_release_rx_buffer(struct rpmsg_endpoint *ept, void *rxbuf);
+
+/**
+ * rpmsg_get_tx_payload_buffer() - Get a tx buffer for message payload.
+ * @ept: the rpmsg endpoint
+ * @len: pointer to store the maximum payload length of the buffer
+ * @wait: boolean, wait or not for buffer to become available
+ *
+ * The caller fills the returned buffer in place and hands it over with
+ * rpmsg_send_nocopy(), or gives it back unsent with
+ * rpmsg_release_tx_buffer().
+ *
+ * Returns pointer to the payload area of the buffer, or NULL on failure.
+ */
+void *rpmsg_get_tx_payload_buffer(struct rpmsg_endpoint *ept,
+				  uint32_t *len, int wait);
+
+/**
+ * rpmsg_release_tx_buffer() - Give back a tx buffer that was not sent.
+ * @ept: the rpmsg endpoint
+ * @txbuf: buffer returned by rpmsg_get_tx_payload_buffer()
+ *
+ * The buffer is kept by the device and handed out again by the next
+ * rpmsg_get_tx_payload_buffer() or send call.
+ */
+void rpmsg_release_tx_buffer(struct rpmsg_endpoint *ept, void *txbuf);
+
+/**
+ * rpmsg_send_offchannel_nocopy() - send a message in tx buffer reserved by
+ * rpmsg_get_tx_payload_buffer() across to the remote processor.
+ * @ept: the rpmsg endpoint
+ * @src: source address
+ * @dst: destination address
+ * @data: TX buffer with message filled
+ * @len: length of payload
+ *
+ * The buffer is owned by the device once this call succeeds.
+ *
+ * Returns number of bytes it has sent or negative error value on failure.
+ */
+int rpmsg_send_offchannel_nocopy(struct rpmsg_endpoint *ept, uint32_t src,
+				 uint32_t dst, const void *data, int len);
+
+/**
+ * rpmsg_send_nocopy() - send a message in tx buffer reserved by
+ * rpmsg_get_tx_payload_buffer() using @ept's source and destination
+ * addresses.
+ * @ept: the rpmsg endpoint
+ * @data: TX buffer with message filled
+ * @len: length of payload
+ *
+ * Returns number of bytes it has sent or negative error value on failure.
+ */
+static inline int rpmsg_send_nocopy(struct rpmsg_endpoint *ept,
+				    const void *data, int len)
+{
+	if (ept->dest_addr == RPMSG_ADDR_ANY)
+		return RPMSG_ERR_ADDR;
+	return rpmsg_send_offchannel_nocopy(ept, ept->addr, ept->dest_addr,
+					    data, len);
+}
+
 /**
  * rpmsg_init_ept - initialize rpmsg endpoint
  *
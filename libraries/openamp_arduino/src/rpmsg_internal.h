@@ -33,6 +33,13 @@ extern "C" {
 #endif
 
 #define RPMSG_LOCATE_DATA(p) ((unsigned char *)(p) + sizeof(struct rpmsg_hdr))
+#define RPMSG_LOCATE_HDR(p) \
+	((struct rpmsg_hdr *)((unsigned char *)(p) - sizeof(struct rpmsg_hdr)))
+
+/* Set in rpmsg_hdr.reserved when the receiver holds on to the buffer;
+ * the lower bits carry the virtqueue buffer index. */
+#define RPMSG_BUF_HELD (1U << 31)
+
 /**
  * enum rpmsg_ns_flags - dynamic name service announcement flags
  *
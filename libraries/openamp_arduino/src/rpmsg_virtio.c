@@ -28,6 +28,15 @@
 #define WORD_ALIGN(a)	((((a) & (WORD_SIZE - 1)) != 0) ? \
 			(((a) & (~(WORD_SIZE - 1))) + WORD_SIZE) : (a))
 
+/*
+ * Bookkeeping for a TX buffer given back unsent, stored in place of the
+ * rpmsg header of the buffer itself.
+ */
+struct vbuff_reclaimer_t {
+	uint32_t idx;
+	struct metal_list node;
+};
+
 #ifndef VIRTIO_SLAVE_ONLY
 metal_weak void *
 rpmsg_virtio_shm_pool_get_buffer(struct rpmsg_virtio_shm_pool *shpool,
@@ -146,6 +155,25 @@ static void *rpmsg_virtio_get_tx_buffer(struct rpmsg_virtio_device *rvdev,
 	unsigned int role = rpmsg_virtio_get_role(rvdev);
 	void *data = NULL;
 
+	if (!metal_list_is_empty(&rvdev->reclaimer)) {
+		struct metal_list *node = metal_list_first(&rvdev->reclaimer);
+		struct vbuff_reclaimer_t *r_desc;
+
+		metal_list_del(node);
+		r_desc = metal_container_of(node, struct vbuff_reclaimer_t,
+					    node);
+		*idx = (unsigned short)r_desc->idx;
+#ifndef VIRTIO_SLAVE_ONLY
+		if (role == RPMSG_MASTER)
+			*len = RPMSG_BUFFER_SIZE;
+#endif /*!VIRTIO_SLAVE_ONLY*/
+#ifndef VIRTIO_MASTER_ONLY
+		if (role == RPMSG_REMOTE)
+			*len = virtqueue_get_buffer_length(rvdev->svq, *idx);
+#endif /*!VIRTIO_MASTER_ONLY*/
+		return r_desc;
+	}
+
 #ifndef VIRTIO_SLAVE_ONLY
 	if (role == RPMSG_MASTER) {
 		data = virtqueue_get_buffer(rvdev->svq, (uint32_t *)len, idx);
@@ -369,6 +397,156 @@ static int rpmsg_virtio_send_offchannel_raw(struct rpmsg_device *rdev,
 	return size;
 }
 
+static void rpmsg_virtio_hold_rx_buffer(struct rpmsg_device *rdev,
+					void *rxbuf)
+{
+	struct rpmsg_hdr *rp_hdr;
+
+	(void)rdev;
+
+	rp_hdr = RPMSG_LOCATE_HDR(rxbuf);
+	/* Set held status to keep buffer */
+	rp_hdr->reserved |= RPMSG_BUF_HELD;
+}
+
+static void rpmsg_virtio_release_rx_buffer(struct rpmsg_device *rdev,
+					   void *rxbuf)
+{
+	struct rpmsg_virtio_device *rvdev;
+	struct rpmsg_hdr *rp_hdr;
+	unsigned short idx;
+	unsigned long len;
+
+	rvdev = metal_container_of(rdev, struct rpmsg_virtio_device, rdev);
+	rp_hdr = RPMSG_LOCATE_HDR(rxbuf);
+	/* The reserved field contains buffer index */
+	idx = (unsigned short)(rp_hdr->reserved & ~RPMSG_BUF_HELD);
+
+	metal_mutex_acquire(&rdev->lock);
+	/* Return buffer on virtqueue. */
+	len = virtqueue_get_buffer_length(rvdev->rvq, idx);
+	rpmsg_virtio_return_buffer(rvdev, rp_hdr, len, idx);
+	metal_mutex_release(&rdev->lock);
+}
+
+static void *rpmsg_virtio_get_tx_payload_buffer(struct rpmsg_device *rdev,
+						uint32_t *len, int wait)
+{
+	struct rpmsg_virtio_device *rvdev;
+	struct rpmsg_hdr *rp_hdr;
+	unsigned short idx = 0;
+	unsigned long buff_len;
+	int tick_count;
+	int status;
+
+	/* Get the associated remote device for channel. */
+	rvdev = metal_container_of(rdev, struct rpmsg_virtio_device, rdev);
+
+	status = rpmsg_virtio_get_status(rvdev);
+	/* Validate device state */
+	if (!(status & VIRTIO_CONFIG_STATUS_DRIVER_OK))
+		return NULL;
+
+	if (wait)
+		tick_count = RPMSG_TICK_COUNT / RPMSG_TICKS_PER_INTERVAL;
+	else
+		tick_count = 0;
+
+	while (1) {
+		/* Lock the device to enable exclusive access to virtqueues */
+		metal_mutex_acquire(&rdev->lock);
+		rp_hdr = rpmsg_virtio_get_tx_buffer(rvdev, &buff_len, &idx);
+		metal_mutex_release(&rdev->lock);
+		if (rp_hdr || !tick_count)
+			break;
+		metal_sleep_usec(RPMSG_TICKS_PER_INTERVAL);
+		tick_count--;
+	}
+
+	if (!rp_hdr)
+		return NULL;
+
+	/* Store the index into the reserved field to be used when sending */
+	rp_hdr->reserved = idx;
+
+	/* Account for the rpmsg header */
+	*len = (uint32_t)(buff_len - sizeof(struct rpmsg_hdr));
+
+	return RPMSG_LOCATE_DATA(rp_hdr);
+}
+
+static void rpmsg_virtio_release_tx_buffer(struct rpmsg_device *rdev,
+					   void *txbuf)
+{
+	struct rpmsg_virtio_device *rvdev;
+	struct rpmsg_hdr *rp_hdr;
+	struct vbuff_reclaimer_t *r_desc;
+	uint32_t idx;
+
+	rvdev = metal_container_of(rdev, struct rpmsg_virtio_device, rdev);
+	rp_hdr = RPMSG_LOCATE_HDR(txbuf);
+	/* The reserved field contains buffer index */
+	idx = rp_hdr->reserved & ~RPMSG_BUF_HELD;
+
+	/* rpmsg buffers are word aligned, reuse the header area */
+	r_desc = (struct vbuff_reclaimer_t *)(void *)
+		 ((unsigned char *)txbuf - sizeof(struct rpmsg_hdr));
+	r_desc->idx = idx;
+
+	metal_mutex_acquire(&rdev->lock);
+	metal_list_add_tail(&rvdev->reclaimer, &r_desc->node);
+	metal_mutex_release(&rdev->lock);
+}
+
+static int rpmsg_virtio_send_offchannel_nocopy(struct rpmsg_device *rdev,
+					       uint32_t src, uint32_t dst,
+					       const void *data, int len)
+{
+	struct rpmsg_virtio_device *rvdev;
+	struct rpmsg_hdr *rp_hdr;
+	unsigned short idx;
+	unsigned long buff_len = 0;
+	unsigned int role;
+	int status;
+
+	/* Get the associated remote device for channel. */
+	rvdev = metal_container_of(rdev, struct rpmsg_virtio_device, rdev);
+	role = rpmsg_virtio_get_role(rvdev);
+
+	rp_hdr = RPMSG_LOCATE_HDR(data);
+	/* The reserved field contains buffer index */
+	idx = (unsigned short)(rp_hdr->reserved & ~RPMSG_BUF_HELD);
+
+	/* Initialize RPMSG header. */
+	rp_hdr->dst = dst;
+	rp_hdr->src = src;
+	rp_hdr->len = len;
+	rp_hdr->reserved = 0;
+	rp_hdr->flags = 0;
+
+	metal_mutex_acquire(&rdev->lock);
+
+#ifndef VIRTIO_SLAVE_ONLY
+	if (role == RPMSG_MASTER)
+		buff_len = RPMSG_BUFFER_SIZE;
+#endif /*!VIRTIO_SLAVE_ONLY*/
+
+#ifndef VIRTIO_MASTER_ONLY
+	if (role == RPMSG_REMOTE)
+		buff_len = virtqueue_get_buffer_length(rvdev->svq, idx);
+#endif /*!VIRTIO_MASTER_ONLY*/
+
+	/* Enqueue buffer on virtqueue. */
+	status = rpmsg_virtio_enqueue_buffer(rvdev, rp_hdr, buff_len, idx);
+	RPMSG_ASSERT(status == VQUEUE_SUCCESS, "failed to enqueue buffer\n");
+	/* Let the other side know that there is a job to process. */
+	virtqueue_kick(rvdev->svq);
+
+	metal_mutex_release(&rdev->lock);
+
+	return len;
+}
+
 /**
  * rpmsg_virtio_tx_callback
  *
@@ -427,6 +605,10 @@ static void rpmsg_virtio_rx_callback(struct virtqueue *vq)
 			 */
 			ept->dest_addr = rp_hdr->src;
 		}
+
+		/* Keep the buffer index in case the callback holds it */
+		rp_hdr->reserved = idx;
+
 		status = ept->cb(ept, (void *)RPMSG_LOCATE_DATA(rp_hdr),
 				   rp_hdr->len, ept->addr, ept->priv);
 
@@ -434,8 +616,9 @@ static void rpmsg_virtio_rx_callback(struct virtqueue *vq)
 			     "unexpected callback status\n");
 		metal_mutex_acquire(&rdev->lock);
 
-		/* Return used buffers. */
-		rpmsg_virtio_return_buffer(rvdev, rp_hdr, len, idx);
+		/* Return used buffers, unless the callback is holding it. */
+		if (!(rp_hdr->reserved & RPMSG_BUF_HELD))
+			rpmsg_virtio_return_buffer(rvdev, rp_hdr, len, idx);
 
 		rp_hdr = (struct rpmsg_hdr *)
 			 rpmsg_virtio_get_rx_buffer(rvdev, &len, &idx);
@@ -558,6 +741,12 @@ int rpmsg_init_vdev(struct rpmsg_virtio_device *rvdev,
 	rdev->ns_bind_cb = ns_bind_cb;
 	vdev->priv = rvdev;
 	rdev->ops.send_offchannel_raw = rpmsg_virtio_send_offchannel_raw;
+	rdev->ops.hold_rx_buffer = rpmsg_virtio_hold_rx_buffer;
+	rdev->ops.release_rx_buffer = rpmsg_virtio_release_rx_buffer;
+	rdev->ops.get_tx_payload_buffer = rpmsg_virtio_get_tx_payload_buffer;
+	rdev->ops.release_tx_buffer = rpmsg_virtio_release_tx_buffer;
+	rdev->ops.send_offchannel_nocopy = rpmsg_virtio_send_offchannel_nocopy;
+	metal_list_init(&rvdev->reclaimer);
 	role = rpmsg_virtio_get_role(rvdev);
 
 #ifndef VIRTIO_SLAVE_ONLY
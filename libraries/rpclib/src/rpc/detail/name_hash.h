@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef NAME_HASH_H_RKDUW2QF
+#define NAME_HASH_H_RKDUW2QF
+
+#include <cstdint>
+
+namespace rpc {
+namespace detail {
+
+//! \brief 32-bit FNV-1a hash of a function name. Written as a single
+//! expression so it stays a C++11 constexpr and folds at compile time.
+//! \param name The null-terminated name to hash.
+//! \param hash The hash of the characters before \p name.
+constexpr uint32_t name_hash(char const *name, uint32_t hash = 2166136261u) {
+    return *name ? name_hash(name + 1,
+                             (hash ^ static_cast<uint8_t>(*name)) * 16777619u)
+                 : hash;
+}
+
+} /* detail */
+} /* rpc */
+
+#endif /* end of include guard: NAME_HASH_H_RKDUW2QF */
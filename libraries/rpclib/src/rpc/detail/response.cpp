@@ -25,9 +25,7 @@ response::response(RPCLIB_MSGPACK::object_handle o) : response() {
 
 RPCLIB_MSGPACK::sbuffer response::get_data() const {
     RPCLIB_MSGPACK::sbuffer data;
-    response_type r(1, id_, error_ ? error_->get() : RPCLIB_MSGPACK::object(),
-                    result_ ? result_->get() : RPCLIB_MSGPACK::object());
-    RPCLIB_MSGPACK::pack(data, r);
+    pack(data);
     return data;
 }
 
@@ -37,6 +37,12 @@ public:
     //! \brief Gets the response data as a RPCLIB_MSGPACK::sbuffer.
     RPCLIB_MSGPACK::sbuffer get_data() const;
 
+    //! \brief Packs the response data into any msgpack-compatible buffer.
+    //! \param buffer The buffer to write to (needs a write(const char*, size_t)
+    //! member).
+    //! \tparam Buffer The type of the buffer.
+    template <typename Buffer> void pack(Buffer &buffer) const;
+
     //! \brief Moves the specified object_handle into the response
     //! as a result.
     //! \param r The result to capture.
@@ -112,6 +118,13 @@ inline response response::make_error(uint32_t id, T &&error) {
     return inst;
 }
 
+template <typename Buffer>
+inline void response::pack(Buffer &buffer) const {
+    response_type r(1, id_, error_ ? error_->get() : RPCLIB_MSGPACK::object(),
+                    result_ ? result_->get() : RPCLIB_MSGPACK::object());
+    RPCLIB_MSGPACK::pack(buffer, r);
+}
+
 } /* detail */
 
 } /* rpc  */
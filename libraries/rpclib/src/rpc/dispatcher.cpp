@@ -27,56 +27,34 @@ response dispatcher::dispatch(RPCLIB_MSGPACK::object const &msg,
 
 response dispatcher::dispatch_call(RPCLIB_MSGPACK::object const &msg,
                                    bool suppress_exceptions) {
-    call_t the_call;
-    msg.convert(the_call);
-
     // TODO: proper validation of protocol (and responding to it)
-    // auto &&type = std::get<0>(the_call);
+    // auto &&type = msg.via.array.ptr[0];
     // assert(type == 0);
 
-    auto &&id = std::get<1>(the_call);
-    auto &&name = std::get<2>(the_call);
-    auto &&args = std::get<3>(the_call);
+    auto id = msg.via.array.ptr[1].as<uint32_t>();
+    auto const &func = msg.via.array.ptr[2];
+    auto const &args = msg.via.array.ptr[3];
+
+    if (func.type == RPCLIB_MSGPACK::type::POSITIVE_INTEGER) {
+        auto func_id = func.as<uint32_t>();
+        auto entry = find_function(func_id);
+        if (entry) {
+            return invoke(id, *entry->name, *entry->func, args,
+                          suppress_exceptions);
+        }
+        return response::make_error(
+            id, RPCLIB_FMT::format("rpclib: server could not find "
+                                   "function with id {0:#x} and argument "
+                                   "count {1}.",
+                                   func_id, args.via.array.size));
+    }
 
+    auto name = func.as<std::string>();
     auto it_func = funcs_.find(name);
 
     if (it_func != end(funcs_)) {
-        LOG_DEBUG("Dispatching call to '{}'", name);
-        try {
-            auto result = (it_func->second)(args);
-            return response::make_result(id, std::move(result));
-        } catch (rpc::detail::client_error &e) {
-            return response::make_error(
-                id, RPCLIB_FMT::format("rpclib: {}", e.what()));
-        } catch (std::exception &e) {
-            if (!suppress_exceptions) {
-                throw;
-            }
-            return response::make_error(
-                id,
-                RPCLIB_FMT::format("rpclib: function '{0}' (called with {1} "
-                                   "arg(s)) "
-                                   "threw an exception. The exception "
-                                   "contained this information: {2}.",
-                                   name, args.via.array.size, e.what()));
-        } catch (rpc::detail::handler_error &) {
-            // doing nothing, the exception was only thrown to
-            // return immediately
-        } catch (rpc::detail::handler_spec_response &) {
-            // doing nothing, the exception was only thrown to
-            // return immediately
-        } catch (...) {
-            if (!suppress_exceptions) {
-                throw;
-            }
-            return response::make_error(
-                id,
-                RPCLIB_FMT::format("rpclib: function '{0}' (called with {1} "
-                                   "arg(s)) threw an exception. The exception "
-                                   "is not derived from std::exception. No "
-                                   "further information available.",
-                                   name, args.via.array.size));
-        }
+        return invoke(id, it_func->first, it_func->second, args,
+                      suppress_exceptions);
     }
     return response::make_error(
         id, RPCLIB_FMT::format("rpclib: server could not find "
@@ -84,24 +62,81 @@ response dispatcher::dispatch_call(RPCLIB_MSGPACK::object const &msg,
                                name, args.via.array.size));
 }
 
+response dispatcher::invoke(uint32_t id, std::string const &name,
+                            adaptor_type &func,
+                            RPCLIB_MSGPACK::object const &args,
+                            bool suppress_exceptions) {
+    LOG_DEBUG("Dispatching call to '{}'", name);
+    try {
+        auto result = func(args);
+        return response::make_result(id, std::move(result));
+    } catch (rpc::detail::client_error &e) {
+        return response::make_error(
+            id, RPCLIB_FMT::format("rpclib: {}", e.what()));
+    } catch (std::exception &e) {
+        if (!suppress_exceptions) {
+            throw;
+        }
+        return response::make_error(
+            id,
+            RPCLIB_FMT::format("rpclib: function '{0}' (called with {1} "
+                               "arg(s)) "
+                               "threw an exception. The exception "
+                               "contained this information: {2}.",
+                               name, args.via.array.size, e.what()));
+    } catch (rpc::detail::handler_error &) {
+        // the handler set its error with respond_error() and threw to
+        // return immediately, that error is the response
+        auto resp = response::make_error(id, this_handler().error_.get());
+        this_handler().clear();
+        return resp;
+    } catch (rpc::detail::handler_spec_response &) {
+        // doing nothing, the exception was only thrown to
+        // return immediately
+    } catch (...) {
+        if (!suppress_exceptions) {
+            throw;
+        }
+        return response::make_error(
+            id,
+            RPCLIB_FMT::format("rpclib: function '{0}' (called with {1} "
+                               "arg(s)) threw an exception. The exception "
+                               "is not derived from std::exception. No "
+                               "further information available.",
+                               name, args.via.array.size));
+    }
+    return response::make_error(
+        id, RPCLIB_FMT::format("rpclib: function '{0}' did not return a "
+                               "result.", name));
+}
+
 response dispatcher::dispatch_notification(RPCLIB_MSGPACK::object const &msg,
                                            bool suppress_exceptions) {
-    notification_t the_call;
-    msg.convert(the_call);
-
     // TODO: proper validation of protocol (and responding to it)
-    // auto &&type = std::get<0>(the_call);
+    // auto &&type = msg.via.array.ptr[0];
     // assert(type == static_cast<uint8_t>(request_type::notification));
 
-    auto &&name = std::get<1>(the_call);
-    auto &&args = std::get<2>(the_call);
+    auto const &func = msg.via.array.ptr[1];
+    auto const &args = msg.via.array.ptr[2];
 
-    auto it_func = funcs_.find(name);
+    adaptor_type *handler = nullptr;
 
-    if (it_func != end(funcs_)) {
-        LOG_DEBUG("Dispatching call to '{}'", name);
+    if (func.type == RPCLIB_MSGPACK::type::POSITIVE_INTEGER) {
+        auto entry = find_function(func.as<uint32_t>());
+        if (entry) {
+            handler = entry->func;
+        }
+    } else {
+        auto it_func = funcs_.find(func.as<std::string>());
+        if (it_func != end(funcs_)) {
+            handler = &it_func->second;
+        }
+    }
+
+    if (handler) {
+        LOG_DEBUG("Dispatching notification");
         try {
-            auto result = (it_func->second)(args);
+            auto result = (*handler)(args);
         } catch (rpc::detail::handler_error &) {
             // doing nothing, the exception was only thrown to
             // return immediately
@@ -117,6 +152,39 @@ response dispatcher::dispatch_notification(RPCLIB_MSGPACK::object const &msg,
     return response::empty();
 }
 
+void dispatcher::index_function(std::string const &name) {
+    auto it_func = funcs_.find(name);
+    if (it_func == end(funcs_)) {
+        return;
+    }
+    // elements of an unordered_map keep their address on rehash, so the
+    // table can point at them
+    auto id = name_hash(name.c_str());
+    for (std::size_t i = 0; i < RPCLIB_FUNC_ID_TABLE_SIZE; i++) {
+        auto &entry = ids_[(id + i) & (RPCLIB_FUNC_ID_TABLE_SIZE - 1)];
+        if (!entry.func) {
+            entry.id = id;
+            entry.name = &it_func->first;
+            entry.func = &it_func->second;
+            return;
+        }
+    }
+    // table full: the function stays callable by name only
+}
+
+dispatcher::id_entry const *dispatcher::find_function(uint32_t id) const {
+    for (std::size_t i = 0; i < RPCLIB_FUNC_ID_TABLE_SIZE; i++) {
+        auto const &entry = ids_[(id + i) & (RPCLIB_FUNC_ID_TABLE_SIZE - 1)];
+        if (!entry.func) {
+            return nullptr;
+        }
+        if (entry.id == id) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
 void dispatcher::enforce_arg_count(std::string const &func, std::size_t found,
                                    std::size_t expected) {
     using detail::client_error;
@@ -139,5 +207,15 @@ void dispatcher::enforce_unique_name(std::string const &func) {
     }
 }
 
+void dispatcher::enforce_unique_id(std::string const &func) {
+    auto entry = find_function(name_hash(func.c_str()));
+    if (entry) {
+        throw std::logic_error(
+            RPCLIB_FMT::format("Function '{}' has the same id as '{}'. "
+                               "Please rename one of them", func,
+                               *entry->name));
+    }
+}
+
 }
 } /* rpc */
@@ -15,12 +15,37 @@
 #include "rpc/detail/func_tools.h"
 #include "rpc/detail/func_traits.h"
 #include "rpc/detail/log.h"
+#include "rpc/detail/name_hash.h"
 #include "rpc/detail/not.h"
 #include "rpc/detail/response.h"
 #include "rpc/detail/make_unique.h"
 
+//! \brief Number of entries of the flat table that maps function ids to
+//! functors. Must be a power of two.
+#ifndef RPCLIB_FUNC_ID_TABLE_SIZE
+#define RPCLIB_FUNC_ID_TABLE_SIZE 32
+#endif
+
+static_assert(RPCLIB_FUNC_ID_TABLE_SIZE > 0 &&
+                  (RPCLIB_FUNC_ID_TABLE_SIZE & (RPCLIB_FUNC_ID_TABLE_SIZE - 1)) == 0,
+              "RPCLIB_FUNC_ID_TABLE_SIZE must be a power of two");
+
 namespace rpc {
 
+//! \brief Identifies a bound function by the hash of its name. Calls made
+//! with an id carry the 32-bit hash on the wire instead of the name, and are
+//! looked up in a flat table instead of a string map.
+//! \code
+//! constexpr rpc::func_id remote_add("remoteAdd");
+//! RPC.call(remote_add, 1, 2);
+//! \endcode
+struct func_id {
+    explicit constexpr func_id(char const *name)
+        : value(detail::name_hash(name)) {}
+
+    uint32_t value;
+};
+
 namespace detail {
 
 //! \brief This class maintains a registry of functors associated with their
@@ -86,13 +111,33 @@ public:
     using adaptor_type = std::function<std::unique_ptr<RPCLIB_MSGPACK::object_handle>(
         RPCLIB_MSGPACK::object const &)>;
 
-    //! \brief This is the type of messages as per the msgpack-rpc spec.
+    //! \brief This is the type of messages as per the msgpack-rpc spec. Calls
+    //! made with a func_id carry a positive integer in place of the name.
     using call_t = std::tuple<int8_t, uint32_t, std::string, RPCLIB_MSGPACK::object>;
 
     //! \brief This is the type of notification messages.
     using notification_t = std::tuple<int8_t, std::string, RPCLIB_MSGPACK::object>;
 
 private:
+    //! \brief Entry of the flat function id table.
+    struct id_entry {
+        uint32_t id;
+        std::string const *name;
+        adaptor_type *func;
+    };
+
+    //! \brief Adds a bound functor to the function id table.
+    void index_function(std::string const &name);
+
+    //! \brief Finds the functor bound to a function id, or nullptr.
+    id_entry const *find_function(uint32_t id) const;
+
+    //! \brief Calls a functor and wraps its result or error in a response.
+    static detail::response invoke(uint32_t id, std::string const &name,
+                                   adaptor_type &func,
+                                   RPCLIB_MSGPACK::object const &args,
+                                   bool suppress_exceptions);
+
     //! \brief Checks the argument count and throws an exception if
     //! it is not the expected amount.
     static void enforce_arg_count(std::string const &func, std::size_t found,
@@ -100,6 +145,8 @@ private:
 
     void enforce_unique_name(std::string const &func);
 
+    void enforce_unique_id(std::string const &func);
+
     //! \brief Dispatches a call (which will have a response).
     detail::response dispatch_call(RPCLIB_MSGPACK::object const &msg,
                                    bool suppress_exceptions = false);
@@ -114,6 +161,7 @@ private:
 
 private:
     std::unordered_map<std::string, adaptor_type> funcs_;
+    id_entry ids_[RPCLIB_FUNC_ID_TABLE_SIZE] = {};
     RPCLIB_CREATE_LOG_CHANNEL(dispatcher)
 };
 }
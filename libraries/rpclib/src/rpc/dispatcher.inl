@@ -4,8 +4,10 @@ namespace detail {
 
 template <typename F> void dispatcher::bind(std::string const &name, F func) {
     enforce_unique_name(name);
+    enforce_unique_id(name);
     bind(name, func, typename detail::func_kind_info<F>::result_kind(),
          typename detail::func_kind_info<F>::args_kind());
+    index_function(name);
 }
 
 template <typename F>